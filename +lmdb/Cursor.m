@@ -8,6 +8,14 @@ classdef Cursor < handle
 % end
 % clear cursor;
 %
+% % Fetch records in chunks.
+% cursor = database.cursor('RDONLY', true);
+% [keys, values, count] = cursor.fetch(1000);
+% while count > 0
+%   [keys, values, count] = cursor.fetch(1000);
+% end
+% clear cursor;
+%
 % See also lmdb.DB.cursor
 
 properties (Access = private)
@@ -71,6 +79,42 @@ methods
     flag = LMDB_('cursor_find', this.id_, key);
   end
 
+  function [keys, values, count] = fetch(this, n, varargin)
+  %FETCH Proceed up to N records and return their keys and values.
+  %
+  % [keys, values, count] = cursor.fetch(1000)
+  %
+  % KEYS and VALUES are cell arrays of COUNT records. The cursor stays at the
+  % last fetched record, and COUNT is less than N at the end of the database.
+  % With an integer 'KEYTYPE', KEYS is a row vector of the class, and with
+  % 'tuple', KEYS is a cell array of the fields of lmdb.tuple keys.
+  %
+  % Options
+  %    'REVERSE' default false
+  %    'TYPE' class of the values, default 'char'
+  %    'SIZE' dimensions of the values, default [1, N]
+  %    'SERIALIZE' decode serialized values, default false
+  %    'KEYTYPE' class of the keys, 'char', 'uint32', 'uint64', 'int64',
+  %              or 'tuple'
+    assert(isscalar(this));
+    [keys, values, count] = LMDB_('cursor_fetch', this.id_, n, varargin{:});
+  end
+
+  function [images, labels, keys] = fetchDatum(this, n, varargin)
+  %FETCHDATUM Proceed up to N Caffe Datum records and return an image batch.
+  %
+  % [images, labels, keys] = cursor.fetchDatum(256)
+  %
+  % See lmdb.DB.mgetDatum for the output format. The batch has less than N
+  % images at the end of the database.
+  %
+  % Options
+  %    'REVERSE' default false
+    assert(isscalar(this));
+    [images, labels, keys] = LMDB_('cursor_fetch_datum', this.id_, n, ...
+                                   varargin{:});
+  end
+
   function key_value = get.key(this)
   %GETKEY Return the current key.
     key_value = LMDB_('cursor_getkey', this.id_);
@@ -81,6 +125,17 @@ methods
     LMDB_('cursor_setkey', this.id_, key_value);
   end
 
+  function key_value = getKey(this, varargin)
+  %GETKEY Return the current key.
+  %
+  % id = cursor.getKey('KEYTYPE', 'uint64')
+  %
+  % Options
+  %    'KEYTYPE' class of the key, 'char', 'uint32', 'uint64', 'int64', or
+  %              'tuple'
+    key_value = LMDB_('cursor_getkey', this.id_, varargin{:});
+  end
+
   function setKey(this, key_value, varargin)
   %SETKEY Set the current key.
   %
@@ -91,7 +146,8 @@ methods
   %    'RESERVE' default false
   %    'APPEND' default false
   %    'APPENDDUP' default false
-  %    'MULTIPLE' default false
+  %
+  % See lmdb.Cursor.putMultiple for 'MULTIPLE'.
     LMDB_('cursor_setkey', this.id_, key_value, varargin{:});
   end
 
@@ -100,6 +156,18 @@ methods
     value_value = LMDB_('cursor_getvalue', this.id_);
   end
 
+  function value_value = getValue(this, varargin)
+  %GETVALUE Return the current value.
+  %
+  % value = cursor.getValue('TYPE', 'single', 'SIZE', [128, 1])
+  %
+  % Options
+  %    'TYPE' class of the value, default 'char'
+  %    'SIZE' dimensions of the value, default [1, N]
+  %    'SERIALIZE' decode a serialized value, default false
+    value_value = LMDB_('cursor_getvalue', this.id_, varargin{:});
+  end
+
   function set.value(this, value_value)
   %SETVALUE Set the current value.
     LMDB_('cursor_setvalue', this.id_, value_value);
@@ -115,10 +183,43 @@ methods
   %    'RESERVE' default false
   %    'APPEND' default false
   %    'APPENDDUP' default false
-  %    'MULTIPLE' default false
+  %    'SERIALIZE' default false
+  %
+  % See lmdb.Cursor.putMultiple for 'MULTIPLE'.
     LMDB_('cursor_setvalue', this.id_, value_value, varargin{:});
   end
 
+  function values = getMultiple(this, varargin)
+  %GETMULTIPLE Return all the duplicates of the current key as a matrix.
+  %
+  % cursor.find('term');
+  % postings = cursor.getMultiple('TYPE', 'uint32')
+  %
+  % Each duplicate is a column of the matrix, and all of them must have the
+  % same size. A 'DUPFIXED' table is read a page at a time. The cursor stays
+  % at the last duplicate.
+  %
+  % Options
+  %    'TYPE' class of the values, default 'uint8'
+    values = LMDB_('cursor_getmultiple', this.id_, varargin{:});
+  end
+
+  function count = putMultiple(this, key_value, values, varargin)
+  %PUTMULTIPLE Save the columns of a matrix as duplicates of the key.
+  %
+  % count = cursor.putMultiple('term', uint32([3, 14, 15, 92]))
+  %
+  % The table must be opened with 'DUPSORT' and 'DUPFIXED', and 'INTEGERDUP'
+  % sorts numeric duplicates by value. COUNT is the number of the written
+  % columns.
+  %
+  % Options
+  %    'NODUPDATA' default false
+  %    'APPENDDUP' default false
+    count = LMDB_('cursor_putmultiple', this.id_, key_value, values, ...
+                  varargin{:});
+  end
+
   function remove(this, varargin)
   %REMOVE Delete the current key and value.
   %
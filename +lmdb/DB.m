@@ -11,6 +11,11 @@ classdef DB < handle
 % value1 = database.get('key1');
 % database.remove('key1');
 %
+% % Batch read and write.
+% database.mput({'key1', 'key2'}, {'value1', 'value2'});
+% [values, found] = database.mget({'key1', 'key2'});
+% database.mremove({'key1', 'key2'});
+%
 % % Iterator.
 % database.each(@(key, value) disp([key, ':', 'value']));
 % count = database.reduce(@(key, value, count) count + 1, 0);
@@ -25,7 +30,7 @@ classdef DB < handle
 %
 % See also lmdb.DB.DB
 
-properties (Access = private)
+properties (SetAccess = protected, GetAccess = {?lmdb.DB, ?lmdb.Transaction})
   id_ % ID of the session.
 end
 
@@ -60,7 +65,52 @@ methods
   %   'MAXREADERS' default 126
   %   'MAXDBS' default 0
   %   'NAME' default ''
+  %   'ASYNC' queue puts and removes for a writer thread, default false
+  %   'QUEUESIZE' maximum number of queued writes, default 100000
+  %   'COMMITSIZE' maximum number of writes in a transaction, default 1000
+  %   'COMMITINTERVAL' maximum seconds to wait for a commit, default 0.1
+  %   'GROWTHPOLICY' factor to grow the map when full, e.g., 2, default 0
+  %   'CACHESIZE' number of decoded values to keep for get and mget, default 0
+  %   'BLOOMBITS' bits per key of a Bloom filter, e.g., 10, default 0
+  %   'ORDINAL' keep the index of getAt current by writes, default false
+  %
+  % With 'GROWTHPOLICY', a write that fills the map aborts its transaction,
+  % multiplies 'MAPSIZE' by the factor, and runs again. The map cannot grow
+  % while a transaction, a cursor, or a loader is open, and a transaction
+  % from lmdb.DB.begin raises an error after growing so that it can be run
+  % again. A map grown by another process is adopted when no transaction is
+  % open.
+  %
+  % With 'ASYNC', put, remove, mput, and mremove return once the write is
+  % queued, and a writer thread commits the queued writes in batches. Reads
+  % do not see the queued writes until they are committed. An error in the
+  % queued writes is raised by the next write or flush, or as a warning when
+  % the database is cleared.
+  %
+  % With 'CACHESIZE', get and mget keep the recently read values in memory
+  % and return copies of them until any write is committed to the
+  % environment, including one from another process.
+  %
+  % With 'BLOOMBITS', get, mget, and exists return missing keys from a Bloom
+  % filter of the keys without reading the table. The filter is built on
+  % open, shared by the objects of the same table, and kept current by the
+  % writes of this process, including transactions, cursors, and queued
+  % writes. A commit from another process builds the filter again at the
+  % next query. 10 bits per key make about 1% of missing keys read the table.
+  %
+  % sample, getAt, rangeAt, rank, and loader use an index of every 64th key,
+  % which the first query builds by listing all the records of the table in
+  % O(N) time, and which this object keeps until a commit. With 'ORDINAL',
+  % the writes through this object, including its transactions and cursors,
+  % keep the index current, and only a commit from elsewhere that changed
+  % the table builds it again. The index is not saved in the database, so
+  % each process that opens the table lists its records at the first query.
+  %
+  % See also lmdb.DB.flush lmdb.Env
     assert(isscalar(this));
+    if nargin == 0
+      return; % Opened by a subclass.
+    end
     assert(ischar(filename));
     this.id_ = LMDB_('new', filename, varargin{:});
   end
@@ -71,20 +121,96 @@ methods
     LMDB_('delete', this.id_);
   end
 
-  function result = get(this, key)
+  function result = get(this, key, varargin)
   %GET Query a record.
+  %
+  % value = database.get('key1')
+  % image = database.get('key1', 'TYPE', 'uint8', 'SIZE', [256, 256, 3])
+  % value = database.get('key1', 'SERIALIZE', true)
+  %
+  % Options
+  %   'TYPE' class of the value, e.g., 'uint8' or 'single', default 'char'
+  %   'SIZE' dimensions of the value, default [1, N]
+  %   'SERIALIZE' decode a value saved with 'SERIALIZE', default false
+  %
+  % Numeric types copy the raw bytes of the record in the native byte order.
+  % With 'SERIALIZE', the class and the dimensions are restored from the
+  % record and a missing record is returned as [].
+    assert(isscalar(this));
+    result = LMDB_('get', this.id_, key, varargin{:});
+  end
+
+  function [result, found] = mget(this, keys, varargin)
+  %MGET Query multiple records in a single transaction.
+  %
+  % [values, found] = database.mget({'key1', 'key2'})
+  % values = database.mget(1:100, 'TYPE', 'single')
+  %
+  % KEYS is a cell array of keys or a numeric array of keys. See lmdb.DB.put
+  % for numeric keys. VALUES is a cell array of records and FOUND is a
+  % logical array indicating which records exist. A missing record is
+  % returned as an empty array.
+  %
+  % See lmdb.DB.get for options.
+    assert(isscalar(this));
+    [result, found] = LMDB_('mget', this.id_, keys, varargin{:});
+  end
+
+  function found = exists(this, keys)
+  %EXISTS Check if records exist.
+  %
+  % found = database.exists('key1')
+  % found = database.exists({'key1', 'key2'})
+  %
+  % KEYS is a key, a cell array of keys, or a numeric array of keys. FOUND is
+  % a logical array indicating which records exist. With 'BLOOMBITS', a
+  % transaction is started only for keys that may exist.
+  %
+  % See also lmdb.DB.DB
+    assert(isscalar(this));
+    found = LMDB_('exists', this.id_, keys);
+  end
+
+  function [images, labels] = mgetDatum(this, keys)
+  %MGETDATUM Query multiple Caffe Datum records as an image batch.
+  %
+  % [images, labels] = database.mgetDatum({'00000000', '00000001'})
+  %
+  % IMAGES is an H-by-W-by-C-by-N array of uint8, or single for Datum with
+  % float_data, and LABELS is an N-by-1 double array. The channel order is
+  % kept as stored, e.g., BGR. Encoded Datum records are returned as a cell
+  % array of uint8 file contents. All records must have the same dimensions.
     assert(isscalar(this));
-    result = LMDB_('get', this.id_, key);
+    [images, labels] = LMDB_('mget_datum', this.id_, keys);
   end
 
   function put(this, key, value, varargin)
   %PUT Save a record in the database.
   %
+  % database.put('key1', 'value1')
+  % database.put('key2', single(rand(64, 64)), 'RESERVE', true)
+  % database.put('key3', struct('x', {1, 'a'}), 'SERIALIZE', true)
+  %
+  % A char value is saved as bytes, and a numeric or logical value is saved
+  % as its raw bytes in the native byte order without an intermediate copy.
+  % A uint32, uint64, or int64 key is saved as an integer in the native byte
+  % order for 'INTEGERKEY', and otherwise in the big-endian byte order with
+  % the sign bit of int64 flipped, so that the keys sort in the numeric order.
+  % Read them back with 'KEYTYPE'. Other numeric keys, including those in a
+  % cell array of keys, are converted to char element by element as in
+  % char(key), while each element of a numeric array of keys in mget, mput,
+  % mremove, and exists is a key formatted with num2str.
+  % 'RESERVE' copies the value directly into the space reserved in the
+  % database page. 'SERIALIZE' saves a numeric, logical, char, cell, or
+  % struct array of any dimensions with its class and dimensions in a compact
+  % binary format.
+  %
   % Options
   %   'NODUPDATA' default false
   %   'NOOVERWRITE' default false
   %   'RESERVE' default false
   %   'APPEND' default false
+  %   'SERIALIZE' default false
     assert(isscalar(this));
     LMDB_('put', this.id_, key, value, varargin{:});
   end
@@ -95,28 +221,107 @@ methods
     LMDB_('remove', this.id_, key, varargin{:});
   end
 
-  function each(this, func)
+  function mput(this, keys, values, varargin)
+  %MPUT Save multiple records in a single transaction.
+  %
+  % database.mput({'key1', 'key2'}, {'value1', 'value2'})
+  %
+  % KEYS is a cell array of keys or a numeric array of keys, and VALUES is a
+  % cell array of the same size. See lmdb.DB.put for numeric keys. Either
+  % all or none of the records are saved.
+  %
+  % Options
+  %   'NODUPDATA' default false
+  %   'NOOVERWRITE' default false
+  %   'RESERVE' default false
+  %   'APPEND' default false
+  %   'SERIALIZE' default false
+    assert(isscalar(this));
+    LMDB_('mput', this.id_, keys, values, varargin{:});
+  end
+
+  function mremove(this, keys)
+  %MREMOVE Remove multiple records in a single transaction.
+  %
+  % database.mremove({'key1', 'key2'})
+  %
+  % Either all or none of the records are removed.
+    assert(isscalar(this));
+    LMDB_('mremove', this.id_, keys);
+  end
+
+  function flush(this)
+  %FLUSH Wait until the queued writes are committed.
+  %
+  % database.flush()
+  %
+  % Raises the error of the queued writes if any. Does nothing unless the
+  % database is opened with 'ASYNC'. Transactions and cursors for writing
+  % also flush the queue when they begin.
+    assert(isscalar(this));
+    LMDB_('flush', this.id_);
+  end
+
+  function load(this, keys, values, varargin)
+  %LOAD Bulk load records in the key order of the database.
+  %
+  % database.load(keys, values)
+  % database.load(keys, values, 'CHUNKSIZE', 1000000)
+  %
+  % Records are sorted by the key comparator of the database and appended in
+  % transactions of CHUNKSIZE records, which gives densely packed pages. When
+  % the same key appears more than once, the last value is saved unless the
+  % database is DUPSORT. Unlike mput, a failure in the middle leaves earlier
+  % chunks committed.
+  %
+  % Options
+  %   'CHUNKSIZE' default 100000
+  %   'SERIALIZE' default false
+    assert(isscalar(this));
+    LMDB_('load', this.id_, keys, values, varargin{:});
+  end
+
+  function each(this, func, varargin)
   %EACH Apply a function to each record.
   %
   % Example: show each record.
   %
   % database.each(@(key, value) disp([key, ': ', value]))
+  %
+  % With 'CHUNKSIZE', the function is called once per chunk of records with
+  % cell arrays of keys and values.
+  %
+  % database.each(@(keys, values) disp(numel(keys)), 'CHUNKSIZE', 10000)
+  %
+  % Options
+  %   'CHUNKSIZE' number of records per call, default 0 (one record per call)
+  %
+  % See lmdb.DB.get for other options.
     assert(isscalar(this));
     assert(ischar(func) || isa(func, 'function_handle'));
     assert(abs(nargin(func)) > 1);
-    LMDB_('each', this.id_, func);
+    LMDB_('each', this.id_, func, varargin{:});
   end
 
-  function result = reduce(this, func, initial_value)
+  function result = reduce(this, func, initial_value, varargin)
   %REDUCE Apply an accumulation function to each record.
   %
   % Example: counting the number of 'foo' in the records.
   %
   % database.reduce(@(key, val, accum) accum + strcmp(val, 'foo'), 0)
+  %
+  % With 'CHUNKSIZE', the function is called once per chunk of records with
+  % cell arrays of keys and values, and the accumulation is passed through
+  % the chunks.
+  %
+  % database.reduce(@(keys, vals, accum) accum + sum(strcmp(vals, 'foo')), ...
+  %                 0, 'CHUNKSIZE', 10000)
+  %
+  % See lmdb.DB.each for options.
     assert(isscalar(this));
     assert(ischar(func) || isa(func, 'function_handle'));
     assert(abs(nargin(func)) > 2 && abs(nargout(func)) > 0);
-    result = LMDB_('reduce', this.id_, func, initial_value);
+    result = LMDB_('reduce', this.id_, func, initial_value, varargin{:});
   end
 
   function transaction = begin(this, varargin)
@@ -162,6 +367,97 @@ methods
     cursor_value = lmdb.Cursor(this.id_, varargin{:});
   end
 
+  function loader_value = loader(this, varargin)
+  %LOADER Create a minibatch iterator that prefetches in the background.
+  %
+  % loader = database.loader('BATCHSIZE', 256, 'SHUFFLE', true)
+  % loader = database.loader('BATCHSIZE', 256, 'DATUM', true)
+  %
+  % Records in the range are addressed by a copy of the index of every 64th
+  % key of lmdb.DB.DB, and worker threads read the next 'PREFETCH' batches
+  % with their own read-only transactions. 'SHUFFLE' visits the records in a
+  % new pseudo-random order in each epoch without listing all the keys. The
+  % loader reads the snapshot of the database when it is created, and does
+  % not see later writes. The snapshot keeps the pages of changed records in
+  % use until the loader is cleared.
+  %
+  % Options
+  %   'BATCHSIZE' number of records in a batch, default 256
+  %   'SHUFFLE' shuffle the order in each epoch, default false
+  %   'SEED' seed of the shuffled orders, default random
+  %   'PREFETCH' number of batches to read ahead, default 4
+  %   'THREADS' number of worker threads, default 2
+  %   'DATUM' decode Caffe Datum records, default false
+  %
+  % See lmdb.DB.keys and lmdb.DB.get for other options. Clear a loader
+  % before modifying the database in the same thread.
+  %
+  % See also lmdb.DataLoader
+    assert(isscalar(this));
+    loader_value = lmdb.DataLoader(this, this.id_, varargin{:});
+  end
+
+  function [values, keys] = sample(this, n, varargin)
+  %SAMPLE Read N random records without replacement.
+  %
+  % [values, keys] = database.sample(256)
+  % values = database.sample(256, 'TYPE', 'single', 'SEED', 1)
+  %
+  % Records are picked uniformly in a pseudo-random order by the index of
+  % every 64th key of lmdb.DB.DB. The first sample builds the index in O(N)
+  % time, and later samples on the same snapshot, or on any snapshot with
+  % 'ORDINAL', read only N records.
+  % A database smaller than N returns all the records.
+  %
+  % Options
+  %   'SEED' seed of the order, default random
+  %
+  % See lmdb.DB.keys and lmdb.DB.get for other options.
+    assert(isscalar(this));
+    [values, keys] = LMDB_('sample', this.id_, n, varargin{:});
+  end
+
+  function [value, key] = getAt(this, index, varargin)
+  %GETAT Query the record at the one-based index in the key order.
+  %
+  % [value, key] = database.getAt(1000)
+  %
+  % See lmdb.DB.rangeAt for the index and lmdb.DB.get for options.
+    assert(isscalar(this) && isscalar(index));
+    [values, keys] = LMDB_('range_at', this.id_, index, index, varargin{:});
+    value = values{1};
+    if iscell(keys)
+      key = keys{1};
+    else
+      key = keys(1);
+    end
+  end
+
+  function [values, keys] = rangeAt(this, first, last, varargin)
+  %RANGEAT Query the records from the index FIRST to LAST in the key order.
+  %
+  % [values, keys] = database.rangeAt(1001, 2000, 'TYPE', 'uint8')
+  %
+  % Indices are one-based and inclusive, and duplicates count as records.
+  % Records are addressed by the index of every 64th key of lmdb.DB.DB, so
+  % that each query seeks the nearest indexed key.
+  %
+  % See lmdb.DB.keys and lmdb.DB.get for options.
+    assert(isscalar(this));
+    [values, keys] = LMDB_('range_at', this.id_, first, last, varargin{:});
+  end
+
+  function [index, found] = rank(this, key)
+  %RANK Get the one-based index of the key in the key order.
+  %
+  % [index, found] = database.rank('key1')
+  %
+  % FOUND indicates whether the key exists. A missing key gets the index it
+  % would have if inserted. See lmdb.DB.rangeAt for the index.
+    assert(isscalar(this));
+    [index, found] = LMDB_('rank', this.id_, key);
+  end
+
   function [key, value] = first(this)
   %FIRST Get the first key-value pair.
   %
@@ -180,20 +476,68 @@ methods
     clear cursor;
   end
 
-  function result = keys(this)
-  %KEYS Get a cell array of all keys.
+  function result = keys(this, varargin)
+  %KEYS Get a cell array of keys.
+  %
+  % keys = database.keys()
+  % keys = database.keys('PREFIX', 'user:', 'LIMIT', 100)
+  % ids = database.keys('KEYTYPE', 'uint64', 'START', uint64(1000))
+  % keys = database.keys('CACHEFILE', './db/keys.cache', 'PACKED', true)
+  %
+  % Options
+  %   'START' inclusive lower bound, default ''
+  %   'END' exclusive upper bound, default none
+  %   'PREFIX' key prefix in the lexicographical order, default ''
+  %   'LIMIT' maximum number of records, default 0 (unlimited)
+  %   'REVERSE' scan in the descending order, default false
+  %   'THREADS' number of threads to scan in parallel, default 1
+  %   'KEYTYPE' class of the keys, 'char', 'uint32', 'uint64', 'int64', or
+  %             'tuple'
+  %   'PACKED' return a char matrix of keys padded with spaces, default false
+  %   'CACHE' keep the keys of the whole database, default false
+  %   'CACHEFILE' file to save and load the cached keys, default none
+  %
+  % With an integer 'KEYTYPE', the keys saved from integers of the class are
+  % returned as a row vector. See lmdb.DB.put for numeric keys. With 'tuple',
+  % each key made by lmdb.tuple is returned as a cell array of the fields.
+  %
+  % With 'CACHE', the keys of the whole database are kept with the database
+  % object and listed again only after a commit to the environment, which is
+  % checked by the last transaction ID. 'CACHEFILE' also saves them to the
+  % file, so that another process opening the unchanged database loads them
+  % without listing. Range options cannot be used with the cache.
+  %
+  % With 'THREADS', the range is split by sampled keys and scanned by worker
+  % threads with their own read-only transactions on the same snapshot. The
+  % order of the result is the same. 'LIMIT' disables the parallel scan, and
+  % each worker uses a reader slot of 'MAXREADERS'.
+    assert(isscalar(this));
+    result = LMDB_('keys', this.id_, varargin{:});
+  end
+
+  function result = values(this, varargin)
+  %VALUES Get a cell array of values.
+  %
+  % values = database.values()
+  % values = database.values('START', 'a', 'END', 'b', 'TYPE', 'uint8')
+  %
+  % See lmdb.DB.keys and lmdb.DB.get for options.
     assert(isscalar(this));
-    result = LMDB_('keys', this.id_);
+    result = LMDB_('values', this.id_, varargin{:});
   end
 
-  function result = values(this)
-  %VALUES Get a cell array of all values.
+  function [keys, values] = scan(this, varargin)
+  %SCAN Get cell arrays of keys and values in a range.
+  %
+  % [keys, values] = database.scan('PREFIX', 'user:')
+  %
+  % See lmdb.DB.keys and lmdb.DB.get for options.
     assert(isscalar(this));
-    result = LMDB_('values', this.id_);
+    [keys, values] = LMDB_('scan', this.id_, varargin{:});
   end
 
   function result = stat(this)
-  %STAT Get the environment statistics.
+  %STAT Get the table statistics.
     assert(isscalar(this));
     result = LMDB_('stat', this.id_);
   end
@@ -0,0 +1,65 @@
+classdef DataLoader < handle
+%DATALOADER LMDB minibatch iterator.
+%
+% loader = database.loader('BATCHSIZE', 256, 'SHUFFLE', true);
+% for epoch = 1:10
+%   done = false;
+%   while ~done
+%     [values, keys, done] = loader.next();
+%     % Train with the values.
+%   end
+% end
+% clear loader;
+%
+% Worker threads read and decode the next batches in the background while
+% MATLAB processes the current one. Each epoch has ceil(loader.size() /
+% 'BATCHSIZE') batches, and the call after the last one starts the next
+% epoch.
+%
+% See also lmdb.DB.loader
+
+properties (Access = private)
+  id_ % ID of the session.
+  database_ % Database object to keep alive.
+end
+
+methods (Hidden)
+  function this = DataLoader(database, database_id, varargin)
+  %DATALOADER Create a new loader.
+  %
+  % See also lmdb.DB.loader
+    assert(isscalar(this));
+    assert(isscalar(database_id));
+    this.database_ = database;
+    this.id_ = LMDB_('loader_new', database_id, varargin{:});
+  end
+end
+
+methods
+  function delete(this)
+  %DELETE Destructor.
+    assert(isscalar(this));
+    LMDB_('loader_delete', this.id_);
+  end
+
+  function varargout = next(this)
+  %NEXT Get the next batch.
+  %
+  % [values, keys, done] = loader.next()
+  % [images, labels, keys, done] = loader.next()  % With 'DATUM'.
+  %
+  % VALUES and KEYS are cell arrays of the records in the batch, and DONE is
+  % true for the last batch of an epoch. With 'DATUM', IMAGES and LABELS are
+  % in the format of lmdb.DB.mgetDatum.
+    assert(isscalar(this));
+    [varargout{1:max(1, nargout)}] = LMDB_('loader_next', this.id_);
+  end
+
+  function result = size(this)
+  %SIZE Get the number of records in an epoch.
+    assert(isscalar(this));
+    result = LMDB_('loader_size', this.id_);
+  end
+end
+
+end
@@ -0,0 +1,98 @@
+classdef Env < handle
+%ENV LMDB environment with multiple tables.
+%
+% environment = lmdb.Env('./db', 'MAXDBS', 16);
+% images = environment.table('images');
+% labels = environment.table('labels');
+% images.put('key1', uint8(rand(32, 32, 3) * 255));
+% labels.put('key1', '3');
+% clear images labels environment;
+%
+% Tables share the memory map, the lock file, and the reader slots of the
+% environment, and keep it open until all of them are cleared.
+%
+% See also lmdb.Table lmdb.DB
+
+properties (Access = private)
+  id_ % ID of the session.
+end
+
+methods
+  function this = Env(filename, varargin)
+  %ENV Open an environment.
+  %
+  % environment = lmdb.Env('./db')
+  % environment = lmdb.Env('./db', 'RDONLY', true, 'MAXDBS', 32)
+  %
+  % Options are the environment options of lmdb.DB.DB, i.e., 'MODE',
+  % 'FIXEDMAP', 'NOSUBDIR', 'NOSYNC', 'RDONLY', 'NOMETASYNC', 'WRITEMAP',
+  % 'MAPASYNC', 'NOTLS', 'NOLOCK', 'NORDAHEAD', 'NOMEMINIT', 'MAPSIZE',
+  % 'MAXREADERS', 'ASYNC', 'QUEUESIZE', 'COMMITSIZE', 'COMMITINTERVAL', and
+  % 'GROWTHPOLICY'. 'MAXDBS' is the maximum number of tables, default 16.
+  %
+  % See also lmdb.DB.DB
+    assert(isscalar(this));
+    assert(ischar(filename));
+    this.id_ = LMDB_('env_new', filename, varargin{:});
+  end
+
+  function delete(this)
+  %DELETE Destructor.
+    assert(isscalar(this));
+    LMDB_('delete', this.id_);
+  end
+
+  function table_value = table(this, name, varargin)
+  %TABLE Open a named table in the environment.
+  %
+  % table = environment.table('labels')
+  % table = environment.table('index', 'DUPSORT', true)
+  %
+  % Options
+  %   'REVERSEKEY'  default false
+  %   'DUPSORT' default false
+  %   'INTEGERKEY' default false
+  %   'DUPFIXED'  default false
+  %   'INTEGERDUP'  default false
+  %   'REVERSEDUP'  default false
+  %   'CREATE'  default true unless the environment is read-only
+  %   'CACHESIZE' number of decoded values to keep for get and mget, default 0
+  %   'BLOOMBITS' bits per key of a Bloom filter, e.g., 10, default 0
+  %   'ORDINAL' keep the index of getAt current by writes, default false
+  %
+  % See also lmdb.Table
+    assert(isscalar(this));
+    table_value = lmdb.Table(this.id_, name, varargin{:});
+  end
+
+  function result = tables(this)
+  %TABLES Get the names of the tables.
+    assert(isscalar(this));
+    result = LMDB_('keys', this.id_);
+  end
+
+  function transaction = begin(this, varargin)
+  %BEGIN Create a new transaction over the tables.
+  %
+  % transaction = environment.begin()
+  % transaction.put(images, 'key1', image)
+  % transaction.put(labels, 'key1', '3')
+  % transaction.commit()
+  %
+  % Records of all the tables are committed together.
+  %
+  % See also lmdb.DB.begin lmdb.Transaction
+    assert(isscalar(this));
+    transaction = lmdb.Transaction(this.id_, varargin{:});
+  end
+
+  function flush(this)
+  %FLUSH Wait until the queued writes of all tables are committed.
+  %
+  % See also lmdb.DB.flush
+    assert(isscalar(this));
+    LMDB_('flush', this.id_);
+  end
+end
+
+end
@@ -0,0 +1,27 @@
+classdef Table < lmdb.DB
+%TABLE LMDB named table in a shared environment.
+%
+% environment = lmdb.Env('./db');
+% table = environment.table('labels');
+% table.put('key1', '3');
+% label = table.get('key1');
+% clear table environment;
+%
+% A table supports all the operations of lmdb.DB, and keeps the environment
+% open after the lmdb.Env object is cleared.
+%
+% See also lmdb.Env lmdb.DB
+
+methods (Hidden)
+  function this = Table(environment_id, name, varargin)
+  %TABLE Open a table.
+  %
+  % See also lmdb.Env.table
+    assert(isscalar(this));
+    assert(isscalar(environment_id));
+    assert(ischar(name));
+    this.id_ = LMDB_('table_new', environment_id, name, varargin{:});
+  end
+end
+
+end
@@ -9,6 +9,12 @@ classdef Transaction < handle
 %   transaction.abort()
 % end
 %
+% % Update several tables atomically.
+% transaction = environment.begin()
+% transaction.put(images, key, image)
+% transaction.put(labels, key, label)
+% transaction.commit()
+%
 % See also lmdb.DB.begin
 
 properties (Access = private)
@@ -45,28 +51,55 @@ methods
     LMDB_('txn_abort', this.id_);
   end
 
-  function result = get(this, key)
+  function result = get(this, varargin)
   %GET Query a record.
+  %
+  % value = transaction.get(key)
+  % value = transaction.get(table, key)
+  %
+  % TABLE is an lmdb.Table in the same environment as the transaction.
+  %
+  % See lmdb.DB.get for options.
     assert(isscalar(this));
-    result = LMDB_('txn_get', this.id_, key);
+    args = this.tableArguments(varargin);
+    result = LMDB_('txn_get', this.id_, args{:});
   end
 
-  function put(this, key, value, varargin)
+  function put(this, varargin)
   %PUT Save a record in the database.
   %
+  % transaction.put(key, value)
+  % transaction.put(table, key, value)
+  %
   % Options
   %   'NODUPDATA' default false
   %   'NOOVERWRITE' default false
   %   'RESERVE' default false
   %   'APPEND' default false
+  %   'SERIALIZE' default false
     assert(isscalar(this));
-    LMDB_('txn_put', this.id_, key, value, varargin{:});
+    args = this.tableArguments(varargin);
+    LMDB_('txn_put', this.id_, args{:});
   end
 
-  function remove(this, key, varargin)
+  function remove(this, varargin)
   %REMOVE Remove a record.
+  %
+  % transaction.remove(key)
+  % transaction.remove(table, key)
+    assert(isscalar(this));
+    args = this.tableArguments(varargin);
+    LMDB_('txn_remove', this.id_, args{:});
+  end
+end
+
+methods (Access = private)
+  function args = tableArguments(this, args)
+  %TABLEARGUMENTS Move a leading table argument to the 'TABLE' option.
     assert(isscalar(this));
-    LMDB_('txn_remove', this.id_, key, varargin{:});
+    if ~isempty(args) && isa(args{1}, 'lmdb.DB')
+      args = [args(2:end), {'TABLE', args{1}.id_}];
+    end
   end
 end
 
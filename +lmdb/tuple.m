@@ -0,0 +1,13 @@
+function key = tuple(varargin)
+%TUPLE Encode fields into a tuple key.
+%
+% key = lmdb.tuple(uint64(user_id), timestamp, 'event')
+%
+% Fields are numeric or logical scalars and char rows. The key is a char row
+% of bytes that sorts in the order of the fields, so that a tuple of leading
+% fields works as 'PREFIX' of a range scan. Fields in the same position
+% should have the same class. Decode tuple keys with 'KEYTYPE', 'tuple'.
+%
+% See also lmdb.DB.keys
+  key = LMDB_('tuple', varargin);
+end
@@ -1,8 +1,23 @@
 /** LMDB Matlab wrapper.
  */
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <functional>
+#include <list>
 #include <lmdb.h>
 #include <memory>
 #include <mexplus.h>
+#include <mutex>
+#include <numeric>
+#include <random>
+#include <thread>
+#include <unordered_map>
 
 using namespace std;
 using namespace mexplus;
@@ -28,16 +43,55 @@ public:
   Record(const string& data) {
     initialize(data);
   }
+  // Copy constructor.
+  Record(const Record& record) { *this = record; }
   virtual ~Record() {}
+  // Copy assignment that keeps the MDB_val pointing to the own buffer.
+  Record& operator=(const Record& record) {
+    if (this != &record) {
+      data_ = record.data_;
+      mdb_val_ = record.mdb_val_;
+      if (record.mdb_val_.mv_data == record.data_.c_str())
+        mdb_val_.mv_data = const_cast<char*>(data_.c_str());
+    }
+    return *this;
+  }
   // Initialize with string.
   void initialize(const string& data) {
     data_.assign(data.begin(), data.end());
     mdb_val_.mv_size = data_.size();
     mdb_val_.mv_data = const_cast<char*>(data_.c_str());
   }
+  // Initialize with mxArray. Char arrays are converted to bytes, and numeric
+  // arrays are referenced without copy, which must outlive the record.
+  void initialize(const mxArray* array) {
+    ASSERT(array, "Null pointer exception.");
+    if (mxIsChar(array)) {
+      const mxChar* chars = mxGetChars(array);
+      data_.assign(chars, chars + mxGetNumberOfElements(array));
+      mdb_val_.mv_size = data_.size();
+      mdb_val_.mv_data = const_cast<char*>(data_.c_str());
+    } else {
+      ASSERT((mxIsNumeric(array) || mxIsLogical(array)) &&
+             !mxIsComplex(array) && !mxIsSparse(array),
+             "Invalid record type: %s.",
+             mxGetClassName(array));
+      data_.clear();
+      mdb_val_.mv_size = mxGetNumberOfElements(array) *
+                         mxGetElementSize(array);
+      mdb_val_.mv_data = mxGetData(array);
+    }
+  }
+  // Initialize by taking over the string buffer.
+  void swap(string* data) {
+    data_.swap(*data);
+    mdb_val_.mv_size = data_.size();
+    mdb_val_.mv_data = const_cast<char*>(data_.c_str());
+  }
   // Sync the buffer.
   void sync() {
-    data_.assign(begin(), end());
+    string data(begin(), end());
+    data_.swap(data);
     mdb_val_.mv_size = data_.size();
     mdb_val_.mv_data = const_cast<char*>(data_.c_str());
   }
@@ -57,33 +111,391 @@ private:
   MDB_val mdb_val_;
 };
 
-// Database manager.
-class Database {
+// Write-behind queue that commits the queued operations in a writer thread.
+// A batch is committed when COMMITSIZE operations are queued, the oldest one
+// waits for the commit interval, or a flush is requested. The writer thread
+// never calls the MEX API, and keeps the first error for the caller. When the
+// map is full and can grow, the batch goes back to the queue and the writer
+// pauses until the caller grows the map and resumes it.
+class AsyncWriter {
+public:
+  // Queued put or remove.
+  struct Operation {
+    MDB_dbi dbi;
+    string key;
+    string value;
+    unsigned int flags;
+    bool remove;
+    chrono::steady_clock::time_point time;
+  };
+
+  // Start the writer thread.
+  AsyncWriter(MDB_env* env,
+              size_t capacity,
+              size_t commit_size,
+              double interval,
+              bool growable) :
+      env_(env),
+      capacity_(max<size_t>(capacity, 1)),
+      commit_size_(max<size_t>(commit_size, 1)),
+      interval_(chrono::duration_cast<chrono::steady_clock::duration>(
+          chrono::duration<double>(max(interval, 0.0)))),
+      growable_(growable),
+      flush_requests_(0),
+      busy_(false),
+      paused_(false),
+      full_(false),
+      stopped_(false),
+      thread_(&AsyncWriter::work, this) {}
+  // Commit the remaining operations and stop the writer thread.
+  virtual ~AsyncWriter() { stop(); }
+  // Commit the remaining operations and stop the writer thread. An error of
+  // the last commits is kept for takeError.
+  void stop() {
+    if (!thread_.joinable())
+      return;
+    {
+      lock_guard<mutex> lock(mutex_);
+      stopped_ = true;
+    }
+    ready_.notify_one();
+    thread_.join();
+  }
+  // Queue an operation, waiting while the queue is full.
+  void push(Operation* operation) {
+    {
+      unique_lock<mutex> lock(mutex_);
+      space_.wait(lock, [this] {
+        return queue_.size() < capacity_ || full_;
+      });
+      operation->time = chrono::steady_clock::now();
+      queue_.push_back(Operation());
+      swap(queue_.back(), *operation);
+    }
+    ready_.notify_one();
+  }
+  // Wait until the queued operations are committed, or return false if the
+  // writer is paused for the map to grow.
+  bool flush() {
+    unique_lock<mutex> lock(mutex_);
+    ++flush_requests_;
+    ready_.notify_one();
+    flushed_.wait(lock, [this] {
+      return full_ || (queue_.empty() && !busy_);
+    });
+    --flush_requests_;
+    return !full_;
+  }
+  // Check if the writer is paused for the map to grow.
+  bool isFull() {
+    lock_guard<mutex> lock(mutex_);
+    return full_;
+  }
+  // Wait for the current batch and keep the writer out of the map.
+  void pause() {
+    unique_lock<mutex> lock(mutex_);
+    paused_ = true;
+    flushed_.wait(lock, [this] { return !busy_; });
+  }
+  // Restart the writer after pause or a full map.
+  void resume() {
+    {
+      lock_guard<mutex> lock(mutex_);
+      paused_ = false;
+      full_ = false;
+    }
+    ready_.notify_one();
+  }
+  // Take the first error since the last call, or an empty string.
+  string takeError() {
+    lock_guard<mutex> lock(mutex_);
+    string error;
+    error.swap(error_);
+    return error;
+  }
+  // Take the IDs of the transactions committed since the last call, after
+  // the batch being written.
+  void takeCommitIDs(vector<size_t>* ids) {
+    unique_lock<mutex> lock(mutex_);
+    flushed_.wait(lock, [this] { return !busy_; });
+    ids->insert(ids->end(), commit_ids_.begin(), commit_ids_.end());
+    commit_ids_.clear();
+  }
+  // Get the keys of the queued puts to the table, including the batch being
+  // written.
+  void getQueuedKeys(MDB_dbi dbi, vector<string>* keys) {
+    lock_guard<mutex> lock(mutex_);
+    for (size_t i = 0; i < batch_.size(); ++i)
+      if (!batch_[i].remove && batch_[i].dbi == dbi)
+        keys->push_back(batch_[i].key);
+    for (size_t i = 0; i < queue_.size(); ++i)
+      if (!queue_[i].remove && queue_[i].dbi == dbi)
+        keys->push_back(queue_[i].key);
+  }
+
+private:
+  // Loop of the writer thread.
+  void work() {
+    unique_lock<mutex> lock(mutex_);
+    while (true) {
+      if (queue_.empty() || paused_ || full_) {
+        if (stopped_ && full_ && error_.empty())
+          error_ = mdb_strerror(MDB_MAP_FULL);
+        if (stopped_ && (queue_.empty() || full_))
+          return;
+        ready_.wait(lock);
+        continue;
+      }
+      if (queue_.size() < commit_size_ && !stopped_ && flush_requests_ == 0 &&
+          ready_.wait_until(lock, queue_.front().time + interval_) !=
+          cv_status::timeout)
+        continue;
+      size_t size = min(queue_.size(), commit_size_);
+      batch_.resize(size);
+      for (size_t i = 0; i < size; ++i)
+        swap(batch_[i], queue_[i]);
+      queue_.erase(queue_.begin(), queue_.begin() + size);
+      busy_ = true;
+      lock.unlock();
+      space_.notify_all();
+      string error;
+      size_t id = 0;
+      // The batch only changes under the lock.
+      int status = commit(&batch_, &error, &id);
+      lock.lock();
+      busy_ = false;
+      if (growable_ &&
+          (status == MDB_MAP_FULL || status == MDB_MAP_RESIZED)) {
+        queue_.insert(queue_.begin(),
+                      make_move_iterator(batch_.begin()),
+                      make_move_iterator(batch_.end()));
+        batch_.clear();
+        full_ = true;
+        space_.notify_all();
+        flushed_.notify_all();
+        continue;
+      }
+      batch_.clear();
+      if (status == MDB_SUCCESS && id > 0)
+        commit_ids_.push_back(id);
+      if (status != MDB_SUCCESS)
+        error = mdb_strerror(status);
+      if (!error.empty() && error_.empty())
+        error_ = error;
+      flushed_.notify_all();
+    }
+  }
+  // Write the operations in a transaction, and return the status of the
+  // batch with the ID of the transaction, or 0 if nothing was written. A
+  // missing or existing key only fails the operation with the error message,
+  // and other errors discard the batch.
+  int commit(vector<Operation>* batch, string* error, size_t* id) {
+    *id = 0;
+    MDB_txn* txn = NULL;
+    int status = mdb_txn_begin(env_, NULL, 0, &txn);
+    if (status != MDB_SUCCESS)
+      return status;
+    // The snapshot of a write transaction is the last commit.
+    MDB_envinfo info;
+    status = mdb_env_info(env_, &info);
+    if (status != MDB_SUCCESS) {
+      mdb_txn_abort(txn);
+      return status;
+    }
+    bool changed = false;
+    for (size_t i = 0; i < batch->size(); ++i) {
+      Operation& operation = (*batch)[i];
+      MDB_val key = {operation.key.size(),
+                     const_cast<char*>(operation.key.data())};
+      MDB_val value = {operation.value.size(),
+                       const_cast<char*>(operation.value.data())};
+      status = (operation.remove) ?
+          mdb_del(txn, operation.dbi, &key, NULL) :
+          mdb_put(txn, operation.dbi, &key, &value, operation.flags);
+      if (status == MDB_SUCCESS && (operation.flags & MDB_RESERVE) &&
+          value.mv_size > 0)
+        memcpy(value.mv_data, operation.value.data(), value.mv_size);
+      if (status == MDB_NOTFOUND || status == MDB_KEYEXIST) {
+        if (error->empty())
+          *error = mdb_strerror(status);
+      } else if (status != MDB_SUCCESS) {
+        mdb_txn_abort(txn);
+        return status;
+      } else {
+        changed = true;
+      }
+    }
+    status = mdb_txn_commit(txn);
+    if (status == MDB_SUCCESS && changed)
+      *id = info.me_last_txnid + 1;
+    return status;
+  }
+
+  // MDB_env pointer.
+  MDB_env* env_;
+  // Maximum number of the queued operations.
+  size_t capacity_;
+  // Maximum number of operations in a transaction.
+  size_t commit_size_;
+  // Maximum time to wait for a batch to fill.
+  chrono::steady_clock::duration interval_;
+  // Flag to pause instead of failing when the map is full.
+  bool growable_;
+  // Queued operations.
+  deque<Operation> queue_;
+  // Operations being written.
+  vector<Operation> batch_;
+  // IDs of the committed transactions since the last check.
+  vector<size_t> commit_ids_;
+  // Number of the callers waiting for flush.
+  int flush_requests_;
+  // Flag to indicate a batch is being written.
+  bool busy_;
+  // Flag to keep the writer out of the map.
+  bool paused_;
+  // Flag to indicate the writer is paused for the map to grow.
+  bool full_;
+  // Flag to stop the writer thread.
+  bool stopped_;
+  // First error message since the last check.
+  string error_;
+  // Mutex for the queue.
+  mutex mutex_;
+  // Condition to wake the writer thread.
+  condition_variable ready_;
+  // Condition to signal free space in the queue.
+  condition_variable space_;
+  // Condition to signal a batch is written.
+  condition_variable flushed_;
+  // Writer thread, started after the other members.
+  thread thread_;
+};
+
+// Bloom filter of the keys of a table in the snapshot of a transaction ID,
+// which tells that a key is missing without starting a transaction. Keys put
+// through the tables of this process are added as they are written or
+// queued, and removed keys remain until the filter is built again.
+class BloomFilter {
+public:
+  // Create an empty filter of the bits per key.
+  explicit BloomFilter(double bits_per_key) :
+      bits_per_key_(bits_per_key),
+      hashes_(static_cast<int>(bits_per_key * 0.69 + 0.5)),
+      capacity_(0),
+      size_(0),
+      id_(0) {
+    hashes_ = max(1, min(30, hashes_));
+    reset(0);
+  }
+  virtual ~BloomFilter() {}
+  // Clear the filter for the number of keys. The ID is unset until the keys
+  // are added and setID is called.
+  void reset(size_t capacity) {
+    capacity_ = (capacity > kMinCapacity) ? capacity : kMinCapacity;
+    size_t words = static_cast<size_t>(ceil(capacity_ * bits_per_key_ / 64));
+    bits_.assign(max(words, static_cast<size_t>(1)), 0);
+    size_ = 0;
+    id_ = 0;
+  }
+  // Add the key.
+  void add(const Record& key) {
+    uint64_t hash = hashKey(key);
+    uint64_t delta = (hash >> 33) | (hash << 31);
+    uint64_t bits = bits_.size() * 64;
+    for (int i = 0; i < hashes_; ++i) {
+      uint64_t bit = hash % bits;
+      bits_[bit / 64] |= uint64_t(1) << (bit % 64);
+      hash += delta;
+    }
+    ++size_;
+  }
+  // Check if the key may exist. False means that the key does not exist.
+  bool mayContain(const Record& key) const {
+    uint64_t hash = hashKey(key);
+    uint64_t delta = (hash >> 33) | (hash << 31);
+    uint64_t bits = bits_.size() * 64;
+    for (int i = 0; i < hashes_; ++i) {
+      uint64_t bit = hash % bits;
+      if (!(bits_[bit / 64] & (uint64_t(1) << (bit % 64))))
+        return false;
+      hash += delta;
+    }
+    return true;
+  }
+  // Check if the filter holds too many keys for its size.
+  bool isFull() const { return size_ > 2 * capacity_; }
+  // Get the transaction ID of the snapshot of the keys.
+  size_t getID() const { return id_; }
+  // Set the transaction ID of the snapshot of the keys.
+  void setID(size_t id) { id_ = id; }
+
+private:
+  // Minimum number of keys to size the filter.
+  static const size_t kMinCapacity = 1024;
+
+  // Hash the key by FNV-1a and the finalizer of splitmix64.
+  static uint64_t hashKey(const Record& key) {
+    uint64_t hash = 0xCBF29CE484222325ull;
+    for (const char* it = key.begin(); it != key.end(); ++it) {
+      hash ^= static_cast<unsigned char>(*it);
+      hash *= 0x100000001B3ull;
+    }
+    hash = (hash ^ (hash >> 30)) * 0xBF58476D1CE4E5B9ull;
+    hash = (hash ^ (hash >> 27)) * 0x94D049BB133111EBull;
+    return hash ^ (hash >> 31);
+  }
+
+  // Number of bits per key.
+  double bits_per_key_;
+  // Number of hash functions.
+  int hashes_;
+  // Number of keys the filter is sized for.
+  size_t capacity_;
+  // Number of added keys.
+  size_t size_;
+  // Transaction ID of the snapshot of the keys.
+  size_t id_;
+  // Bit array.
+  vector<uint64_t> bits_;
+};
+
+// Environment manager shared by the tables in it.
+class Environment {
 public:
-  // Create an empty database environment.
-  Database() : env_(NULL) {
+  // Create an empty environment.
+  Environment() : env_(NULL), reader_(NULL), reader_busy_(false),
+                  growth_factor_(0), transactions_(0) {
     int status = mdb_env_create(&env_);
     ASSERT(status == MDB_SUCCESS, mdb_strerror(status));
   }
-  virtual ~Database() { close(); }
+  virtual ~Environment() { close(); }
   // Open an environment.
   void openEnv(const char* filename, unsigned int flags, mdb_mode_t mode) {
     ASSERT(env_, "MDB_env not created.");
     int status = mdb_env_open(env_, filename, flags, mode);
     ASSERT(status == MDB_SUCCESS, mdb_strerror(status));
   }
-  // Open a table.
-  void openDBI(MDB_txn* txn, const char* name, unsigned int flags) {
-    ASSERT(env_, "MDB_env not opened.");
-    int status = mdb_dbi_open(txn, name, flags, &dbi_);
-    ASSERT(status == MDB_SUCCESS, mdb_strerror(status));
-  }
-  // Close both the table and the environment.
+  // Close the environment with all the tables.
   void close() {
-    if (env_) {
-      mdb_dbi_close(env_, dbi_);
-      mdb_env_close(env_);
+    // Commit the queued writes, growing the map if nothing else uses it.
+    while (writer_ && !writer_->flush() && transactions_ == 0 &&
+           !reader_busy_ && resizeMap(0) == MDB_SUCCESS) {}
+    if (writer_) {
+      writer_->stop();
+      // Report the lost writes, as a destructor cannot raise an error.
+      string error = writer_->takeError();
+      if (!error.empty())
+        mexWarnMsgIdAndTxt("lmdb:warning",
+                           "Queued writes were not committed: %s",
+                           error.c_str());
     }
+    writer_.reset();
+    if (reader_)
+      mdb_txn_abort(reader_);
+    reader_ = NULL;
+    reader_busy_ = false;
+    if (env_)
+      mdb_env_close(env_);
     env_ = NULL;
   }
   // Set the size of the memory map to use for this environment.
@@ -91,6 +503,41 @@ public:
     int status = mdb_env_set_mapsize(env_, mapsize);
     ASSERT(status == MDB_SUCCESS, mdb_strerror(status));
   }
+  // Set the factor to grow the map when full, or 0 to keep the size.
+  void setGrowthFactor(double factor) {
+    ASSERT(factor == 0 || factor > 1,
+           "GROWTHPOLICY must be 0 or greater than 1.");
+    growth_factor_ = factor;
+  }
+  // Check if the map grows when full.
+  bool canGrow() const { return growth_factor_ > 0; }
+  // Grow the map after MDB_MAP_FULL. No transaction of this process may be
+  // active.
+  void grow() {
+    ASSERT(canGrow(), mdb_strerror(MDB_MAP_FULL));
+    checkResizable();
+    int status = resizeMap(0);
+    ASSERT(status == MDB_SUCCESS, mdb_strerror(status));
+  }
+  // Begin a transaction. After another process grew the map, the new size is
+  // adopted when no other transaction of this process is active.
+  MDB_txn* beginTransaction(MDB_txn* parent, unsigned int flags) {
+    ASSERT(env_, "MDB_env not opened.");
+    MDB_txn* txn = NULL;
+    int status = mdb_txn_begin(env_, parent, flags, &txn);
+    if (status == MDB_MAP_RESIZED && transactions_ == 0 && !reader_busy_) {
+      status = resizeMap(1);
+      if (status == MDB_SUCCESS)
+        status = mdb_txn_begin(env_, parent, flags, &txn);
+    }
+    ASSERT(status == MDB_SUCCESS, mdb_strerror(status));
+    ++transactions_;
+    return txn;
+  }
+  // Count the end of a transaction from beginTransaction or addTransaction.
+  void endTransaction() { --transactions_; }
+  // Count a transaction that keeps the map in use, e.g., in worker threads.
+  void addTransaction() { ++transactions_; }
   // Set the maximum number of threads/reader slots for the environment.
   void setMaxReaders(unsigned int readers) {
     int status = mdb_env_set_maxreaders(env_, readers);
@@ -101,26 +548,636 @@ public:
     int status = mdb_env_set_maxdbs(env_, dbs);
     ASSERT(status == MDB_SUCCESS, mdb_strerror(status));
   }
+  // Renew the cached read-only transaction, or return NULL if it is in use.
+  MDB_txn* renewReader() {
+    ASSERT(env_, "MDB_env not opened.");
+    if (reader_busy_)
+      return NULL;
+    int status = (reader_) ? mdb_txn_renew(reader_) :
+                             mdb_txn_begin(env_, NULL, MDB_RDONLY, &reader_);
+    if (status != MDB_SUCCESS && reader_) {
+      // A failed renewal leaves the transaction unusable.
+      mdb_txn_abort(reader_);
+      reader_ = NULL;
+    }
+    if (status == MDB_MAP_RESIZED && transactions_ == 0) {
+      // Another process grew the map.
+      status = resizeMap(1);
+      if (status == MDB_SUCCESS)
+        status = mdb_txn_begin(env_, NULL, MDB_RDONLY, &reader_);
+    }
+    ASSERT(status == MDB_SUCCESS, mdb_strerror(status));
+    reader_busy_ = true;
+    return reader_;
+  }
+  // Reset the cached read-only transaction for later renewal.
+  void resetReader() {
+    if (reader_)
+      mdb_txn_reset(reader_);
+    reader_busy_ = false;
+  }
+  // Start the write-behind queue for puts and removes.
+  void startWriter(size_t capacity, size_t commit_size, double interval) {
+    ASSERT(env_, "MDB_env not opened.");
+    writer_.reset(new AsyncWriter(env_, capacity, commit_size, interval,
+                                  canGrow()));
+  }
+  // Check if puts and removes are queued.
+  bool isAsync() const { return writer_.get() != NULL; }
+  // Queue a put after raising the error of the previous queued writes.
+  void queuePut(MDB_dbi dbi, Record* key, Record* value,
+                unsigned int flags) {
+    checkWriter();
+    addKey(dbi, *key);
+    AsyncWriter::Operation operation;
+    operation.dbi = dbi;
+    operation.key.assign(key->begin(), key->end());
+    operation.value.assign(value->begin(), value->end());
+    operation.flags = flags;
+    operation.remove = false;
+    writer_->push(&operation);
+  }
+  // Queue a remove after raising the error of the previous queued writes.
+  void queueRemove(MDB_dbi dbi, Record* key) {
+    checkWriter();
+    AsyncWriter::Operation operation;
+    operation.dbi = dbi;
+    operation.key.assign(key->begin(), key->end());
+    operation.flags = 0;
+    operation.remove = true;
+    writer_->push(&operation);
+  }
+  // Wait for the queued writes and raise their error if any.
+  void flush() {
+    if (writer_) {
+      while (!writer_->flush())
+        grow();
+      checkWriter();
+    }
+  }
+  // Get the ID of the last committed transaction in the environment.
+  size_t getLastTransactionID() {
+    MDB_envinfo info;
+    int status = mdb_env_info(env_, &info);
+    ASSERT(status == MDB_SUCCESS, mdb_strerror(status));
+    return info.me_last_txnid;
+  }
+  // Get the Bloom filter shared by the tables of the MDB_dbi, or a new one
+  // of the bits per key if none.
+  shared_ptr<BloomFilter> shareBloomFilter(MDB_dbi dbi, double bits_per_key) {
+    if (bloom_filters_.size() <= dbi)
+      bloom_filters_.resize(dbi + 1);
+    shared_ptr<BloomFilter> filter = bloom_filters_[dbi].lock();
+    if (!filter) {
+      filter.reset(new BloomFilter(bits_per_key));
+      bloom_filters_[dbi] = filter;
+    }
+    return filter;
+  }
+  // Add a key written to the table of the MDB_dbi to its Bloom filter.
+  void addKey(MDB_dbi dbi, const Record& key) {
+    if (dbi < bloom_filters_.size()) {
+      shared_ptr<BloomFilter> filter = bloom_filters_[dbi].lock();
+      if (filter)
+        filter->add(key);
+    }
+  }
+  // Keep the ID of a transaction committed by this process, whose written
+  // keys are in the Bloom filters.
+  void addCommitID(size_t id) {
+    commit_ids_.insert(upper_bound(commit_ids_.begin(), commit_ids_.end(), id),
+                       id);
+    if (commit_ids_.size() > kMaxCommitIDs)
+      commit_ids_.erase(commit_ids_.begin(),
+                        commit_ids_.begin() + kMaxCommitIDs / 2);
+  }
+  // Check if the transaction of the ID was committed by this process,
+  // including the queued writes.
+  bool isOwnCommit(size_t id) {
+    if (writer_) {
+      vector<size_t> ids;
+      writer_->takeCommitIDs(&ids);
+      for (size_t i = 0; i < ids.size(); ++i)
+        addCommitID(ids[i]);
+    }
+    return binary_search(commit_ids_.begin(), commit_ids_.end(), id);
+  }
+  // Get the keys of the queued puts to the table of the MDB_dbi.
+  void getQueuedKeys(MDB_dbi dbi, vector<string>* keys) {
+    if (writer_)
+      writer_->getQueuedKeys(dbi, keys);
+  }
   // Get the raw MDB_env pointer.
   MDB_env* getEnv() { return env_; }
-  // Get the raw MDB_dbi pointer.
-  MDB_dbi getDBI() { return dbi_; }
 
 private:
+  // Maximum number of the kept commit IDs.
+  static const size_t kMaxCommitIDs = 1024;
+
   // MDB_env pointer.
   MDB_env* env_;
+  // Cached read-only MDB_txn pointer.
+  MDB_txn* reader_;
+  // Flag to indicate the cached transaction is in use.
+  bool reader_busy_;
+  // Write-behind queue, or NULL for synchronous writes.
+  unique_ptr<AsyncWriter> writer_;
+  // Factor to grow the map when full, or 0 to keep the size.
+  double growth_factor_;
+  // Number of active transactions of this process except the cached one.
+  size_t transactions_;
+  // Bloom filters of the tables by MDB_dbi.
+  vector<weak_ptr<BloomFilter>> bloom_filters_;
+  // Recent IDs of the transactions committed by this process in order.
+  vector<size_t> commit_ids_;
+
+  // Raise the error of the previous queued writes, after growing the map if
+  // the writer needs it.
+  void checkWriter() {
+    if (writer_->isFull())
+      grow();
+    string error = writer_->takeError();
+    ASSERT(error.empty(), "Asynchronous write failed: %s", error.c_str());
+  }
+  // Raise an error unless the map can be replaced.
+  void checkResizable() {
+    ASSERT(transactions_ == 0 && !reader_busy_,
+           "%s. Close transactions, cursors, and loaders to grow the map.",
+           mdb_strerror(MDB_MAP_FULL));
+  }
+  // Replace the map with the size multiplied by the factor, or with the size
+  // set by another process if the factor is 1. The writer thread is kept out
+  // of the map and resumed afterwards.
+  int resizeMap(double factor) {
+    MDB_envinfo info;
+    MDB_stat stat;
+    int status = mdb_env_info(env_, &info);
+    if (status == MDB_SUCCESS)
+      status = mdb_env_stat(env_, &stat);
+    if (status != MDB_SUCCESS)
+      return status;
+    if (factor == 0)
+      factor = growth_factor_;
+    size_t mapsize = 0;
+    if (factor > 1) {
+      double pages = ceil(info.me_mapsize * factor / stat.ms_psize);
+      mapsize = static_cast<size_t>(pages) * stat.ms_psize;
+    }
+    if (writer_)
+      writer_->pause();
+    status = mdb_env_set_mapsize(env_, mapsize);
+    if (writer_)
+      writer_->resume();
+    return status;
+  }
+};
+
+class KeyCache;
+
+// Bounded LRU cache of decoded values in the snapshot of a transaction ID.
+// The values are kept as persistent arrays and returned as copies, and the
+// cache is cleared when the ID advances after any commit to the environment.
+class ValueCache {
+public:
+  explicit ValueCache(size_t capacity) : capacity_(capacity), id_(0) {}
+  virtual ~ValueCache() { clear(); }
+  // Get the cached value of the key in the snapshot, or NULL.
+  const mxArray* get(size_t id, const string& key) {
+    if (id != id_) {
+      clear();
+      id_ = id;
+      return NULL;
+    }
+    unordered_map<string, list<Entry>::iterator>::iterator it =
+        index_.find(key);
+    if (it == index_.end())
+      return NULL;
+    entries_.splice(entries_.begin(), entries_, it->second);
+    return it->second->second;
+  }
+  // Cache a copy of the value of the key in the snapshot, evicting the least
+  // recently used value when full.
+  void put(size_t id, const string& key, const mxArray* value) {
+    if (id != id_) {
+      clear();
+      id_ = id;
+    }
+    if (capacity_ == 0 || index_.find(key) != index_.end())
+      return;
+    mxArray* array = mxDuplicateArray(value);
+    MEXPLUS_CHECK_NOTNULL(array);
+    mexMakeArrayPersistent(array);
+    entries_.push_front(Entry(key, array));
+    index_[key] = entries_.begin();
+    if (entries_.size() > capacity_) {
+      index_.erase(entries_.back().first);
+      mxDestroyArray(entries_.back().second);
+      entries_.pop_back();
+    }
+  }
+  // Destroy the cached values.
+  void clear() {
+    for (list<Entry>::iterator it = entries_.begin(); it != entries_.end();
+         ++it)
+      mxDestroyArray(it->second);
+    entries_.clear();
+    index_.clear();
+  }
+  // Number of cached values.
+  size_t size() const { return entries_.size(); }
+
+private:
+  typedef pair<string, mxArray*> Entry;
+
+  // Maximum number of cached values.
+  size_t capacity_;
+  // Transaction ID of the cached values.
+  size_t id_;
+  // Cached values from the most to the least recently used.
+  list<Entry> entries_;
+  // Cached values by key.
+  unordered_map<string, list<Entry>::iterator> index_;
+};
+
+// Ordinal index of all the records of a table, which the write transactions
+// through a table opened with ORDINAL keep current. It keeps the key of about
+// every kStride-th record, moved to the next first duplicate of a key, and
+// the ordinal of the first record at or after each indexed key, so that the
+// record of an ordinal is found by seeking the nearest indexed key and moving
+// the cursor a few records. A committed write shifts the ordinals after its
+// key, and records between indexed keys that grew too many are split at the
+// next use. The index is tagged with the transaction ID and the statistics of
+// the table, and a commit from elsewhere that changed the statistics makes it
+// built again. Seeking does not call the MEX API and is safe in any thread.
+class OrdinalIndex {
+public:
+  // Create an empty index.
+  OrdinalIndex() : size_(0), duplicates_(false), id_(0), generation_(0),
+                   unbalanced_(false) {
+    memset(&stat_, 0, sizeof(stat_));
+    clear();
+  }
+  virtual ~OrdinalIndex() {}
+  // Index the records of the table in the read-only transaction on the
+  // snapshot of the transaction ID.
+  void build(MDB_txn* txn, MDB_dbi dbi, size_t id) {
+    unsigned int flags = 0;
+    int status = mdb_dbi_flags(txn, dbi, &flags);
+    ASSERT(status == MDB_SUCCESS, mdb_strerror(status));
+    status = mdb_stat(txn, dbi, &stat_);
+    ASSERT(status == MDB_SUCCESS, mdb_strerror(status));
+    duplicates_ = flags & MDB_DUPSORT;
+    size_ = stat_.ms_entries;
+    clear();
+    MDB_cursor* cursor = NULL;
+    status = mdb_cursor_open(txn, dbi, &cursor);
+    ASSERT(status == MDB_SUCCESS, mdb_strerror(status));
+    indexRecords(cursor, 0, size_, this);
+    mdb_cursor_close(cursor);
+    id_ = id;
+    ++generation_;
+    unbalanced_ = false;
+  }
+  // Split the records between indexed keys that grew too many, in the
+  // read-only transaction on the snapshot of the index.
+  void split(MDB_txn* txn, MDB_dbi dbi) {
+    if (!unbalanced_)
+      return;
+    OrdinalIndex index;
+    MDB_cursor* cursor = NULL;
+    int status = mdb_cursor_open(txn, dbi, &cursor);
+    ASSERT(status == MDB_SUCCESS, mdb_strerror(status));
+    for (size_t i = 0; i < ordinals_.size(); ++i) {
+      if (i > 0)
+        index.append(ordinals_[i], getIndexedKey(i));
+      if (getCount(i) > 2 * kStride)
+        indexRecords(cursor, i, getCount(i), &index);
+    }
+    mdb_cursor_close(cursor);
+    ordinals_.swap(index.ordinals_);
+    key_buffer_.swap(index.key_buffer_);
+    key_offsets_.swap(index.key_offsets_);
+    ++generation_;
+    unbalanced_ = false;
+  }
+  // Shift the ordinals by the changes of the number of records after each
+  // indexed key in a write transaction on the snapshot of the ID, which
+  // committed as the next ID with the statistics. Changes of another
+  // snapshot or generation of the index are ignored.
+  void apply(const vector<ptrdiff_t>& changes,
+             size_t generation,
+             size_t id,
+             const MDB_stat& stat) {
+    if (generation != generation_ || id != id_)
+      return;
+    ptrdiff_t shift = 0;
+    for (size_t i = 0; i < ordinals_.size(); ++i) {
+      ordinals_[i] += shift;
+      shift += changes[i];
+    }
+    size_ += shift;
+    for (size_t i = 0; i < ordinals_.size(); ++i)
+      if (changes[i] > 0 && getCount(i) > 2 * kStride)
+        unbalanced_ = true;
+    stat_ = stat;
+    id_ = id + 1;
+  }
+  // Get the position of the indexed key at or before the key, in the
+  // transaction. Records before the second indexed key are at position 0.
+  size_t find(MDB_txn* txn, MDB_dbi dbi, const MDB_val& key) const {
+    size_t lower = 1;
+    size_t upper = ordinals_.size();
+    while (lower < upper) {
+      size_t middle = (lower + upper) / 2;
+      MDB_val indexed_key = getIndexedKey(middle);
+      if (mdb_cmp(txn, dbi, &indexed_key, &key) <= 0)
+        lower = middle + 1;
+      else
+        upper = middle;
+    }
+    return lower - 1;
+  }
+  // Move the cursor to the record of the ordinal and return the LMDB status.
+  // The position is the ordinal at the cursor, or the size if unknown, and
+  // the cursor moves from there when it is closer than the index.
+  int seek(MDB_cursor* cursor,
+           size_t ordinal,
+           size_t* position,
+           MDB_val* key,
+           MDB_val* value) const {
+    if (ordinal >= size_)
+      return MDB_NOTFOUND;
+    size_t anchor = upper_bound(ordinals_.begin(), ordinals_.end(), ordinal) -
+                    ordinals_.begin() - 1;
+    int status = MDB_SUCCESS;
+    bool moved = false;
+    if (*position >= size_ || *position < ordinals_[anchor] ||
+        (*position > ordinal &&
+         *position - ordinal > ordinal - ordinals_[anchor])) {
+      status = seekIndexedKey(cursor, anchor, key, value);
+      *position = ordinals_[anchor];
+      moved = true;
+    }
+    while (status == MDB_SUCCESS && *position < ordinal) {
+      status = mdb_cursor_get(cursor, key, value, MDB_NEXT);
+      ++*position;
+      moved = true;
+    }
+    while (status == MDB_SUCCESS && *position > ordinal) {
+      status = mdb_cursor_get(cursor, key, value, MDB_PREV);
+      --*position;
+      moved = true;
+    }
+    if (status == MDB_SUCCESS && !moved)
+      status = mdb_cursor_get(cursor, key, value, MDB_GET_CURRENT);
+    if (status != MDB_SUCCESS)
+      *position = size_;
+    return status;
+  }
+  // Get the number of records before the key in the key order, and check if
+  // the key exists, in the transaction of the cursor.
+  size_t rank(MDB_cursor* cursor, const MDB_val& key, bool* found) const {
+    MDB_txn* txn = mdb_cursor_txn(cursor);
+    MDB_dbi dbi = mdb_cursor_dbi(cursor);
+    size_t anchor = find(txn, dbi, key);
+    size_t ordinal = ordinals_[anchor];
+    MDB_val current_key, value;
+    int status = seekIndexedKey(cursor, anchor, &current_key, &value);
+    while (status == MDB_SUCCESS &&
+           mdb_cmp(txn, dbi, &current_key, &key) < 0) {
+      status = mdb_cursor_get(cursor, &current_key, &value, MDB_NEXT);
+      ++ordinal;
+    }
+    *found = status == MDB_SUCCESS &&
+             mdb_cmp(txn, dbi, &current_key, &key) == 0;
+    return ordinal;
+  }
+  // Check if the index is built and the statistics of the table are those of
+  // the index.
+  bool matches(const MDB_stat& stat) const {
+    return generation_ > 0 &&
+           stat.ms_entries == stat_.ms_entries &&
+           stat.ms_depth == stat_.ms_depth &&
+           stat.ms_branch_pages == stat_.ms_branch_pages &&
+           stat.ms_leaf_pages == stat_.ms_leaf_pages &&
+           stat.ms_overflow_pages == stat_.ms_overflow_pages;
+  }
+  // Get the number of records.
+  size_t size() const { return size_; }
+  // Get the number of indexed keys.
+  size_t getKeyCount() const { return ordinals_.size(); }
+  // Get the transaction ID of the snapshot.
+  size_t getID() const { return id_; }
+  // Tag the index with the snapshot of an unchanged table.
+  void setID(size_t id) { id_ = id; }
+  // Get the generation of the indexed keys, which changes when they do.
+  size_t getGeneration() const { return generation_; }
+
+private:
+  // Keep only the first indexed key, which is empty.
+  void clear() {
+    ordinals_.assign(1, 0);
+    key_buffer_.clear();
+    key_offsets_.assign(2, 0);
+  }
+  // Append an indexed key at the ordinal.
+  void append(size_t ordinal, const MDB_val& key) {
+    ordinals_.push_back(ordinal);
+    key_buffer_.append(static_cast<const char*>(key.mv_data), key.mv_size);
+    key_offsets_.push_back(key_buffer_.size());
+  }
+  // Get the index-th indexed key.
+  MDB_val getIndexedKey(size_t index) const {
+    MDB_val key;
+    key.mv_data = const_cast<char*>(key_buffer_.data() + key_offsets_[index]);
+    key.mv_size = key_offsets_[index + 1] - key_offsets_[index];
+    return key;
+  }
+  // Get the number of records from the index-th indexed key to the next.
+  size_t getCount(size_t index) const {
+    return ((index + 1 < ordinals_.size()) ? ordinals_[index + 1] : size_) -
+           ordinals_[index];
+  }
+  // Move the cursor to the first record at or after the index-th indexed
+  // key. The first indexed key stands for the first record.
+  int seekIndexedKey(MDB_cursor* cursor,
+                     size_t index,
+                     MDB_val* key,
+                     MDB_val* value) const {
+    if (index == 0)
+      return mdb_cursor_get(cursor, key, value, MDB_FIRST);
+    *key = getIndexedKey(index);
+    return mdb_cursor_get(cursor, key, value, MDB_SET_RANGE);
+  }
+  // Append the keys of every kStride-th of the count records after the
+  // index-th indexed key to the target index.
+  void indexRecords(MDB_cursor* cursor,
+                    size_t index,
+                    size_t count,
+                    OrdinalIndex* target) const {
+    MDB_val key, value;
+    MDB_val previous = {0, NULL};
+    size_t last = 0;
+    int status = seekIndexedKey(cursor, index, &key, &value);
+    for (size_t i = 0; i < count && status == MDB_SUCCESS; ++i) {
+      if (i - last >= kStride &&
+          (!duplicates_ || key.mv_size != previous.mv_size ||
+           memcmp(key.mv_data, previous.mv_data, key.mv_size) != 0)) {
+        target->append(ordinals_[index] + i, key);
+        last = i;
+      }
+      previous = key;
+      status = mdb_cursor_get(cursor, &key, &value, MDB_NEXT);
+    }
+  }
+
+  // Number of records between the indexed keys.
+  static const size_t kStride = 64;
+
+  // Number of records.
+  size_t size_;
+  // Flag to indicate the table has duplicates.
+  bool duplicates_;
+  // Transaction ID of the snapshot.
+  size_t id_;
+  // Generation of the indexed keys.
+  size_t generation_;
+  // Flag to indicate records between indexed keys to split.
+  bool unbalanced_;
+  // Statistics of the table in the snapshot.
+  MDB_stat stat_;
+  // Ordinals of the first records at or after the indexed keys.
+  vector<size_t> ordinals_;
+  // Indexed keys in a single buffer.
+  string key_buffer_;
+  // Offsets of the indexed keys in the buffer.
+  vector<size_t> key_offsets_;
+};
+
+// Database manager for a table in a shared environment.
+class Database {
+public:
+  // Create a table in a new environment.
+  Database() : environment_(new Environment), dbi_(0), flags_(0),
+                ordinal_index_(new OrdinalIndex), ordinal_(false) {}
+  // Create a table in the shared environment.
+  explicit Database(const shared_ptr<Environment>& environment) :
+      environment_(environment), dbi_(0), flags_(0),
+      ordinal_index_(new OrdinalIndex), ordinal_(false) {}
+  virtual ~Database() {}
+  // Open the table.
+  void openDBI(MDB_txn* txn, const char* name, unsigned int flags) {
+    ASSERT(getEnv(), "MDB_env not opened.");
+    int status = mdb_dbi_open(txn, name, flags, &dbi_);
+    ASSERT(status == MDB_SUCCESS, mdb_strerror(status));
+    status = mdb_dbi_flags(txn, dbi_, &flags_);
+    ASSERT(status == MDB_SUCCESS, mdb_strerror(status));
+  }
+  // Get the environment.
+  const shared_ptr<Environment>& getEnvironment() { return environment_; }
+  // Check if the map grows when full.
+  bool canGrow() const { return environment_->canGrow(); }
+  // Grow the map after MDB_MAP_FULL.
+  void grow() { environment_->grow(); }
+  // Begin a transaction in the environment.
+  MDB_txn* beginTransaction(MDB_txn* parent, unsigned int flags) {
+    return environment_->beginTransaction(parent, flags);
+  }
+  // Count the end of a transaction.
+  void endTransaction() { environment_->endTransaction(); }
+  // Count a transaction that keeps the map in use.
+  void addTransaction() { environment_->addTransaction(); }
+  // Renew the cached read-only transaction, or return NULL if it is in use.
+  MDB_txn* renewReader() { return environment_->renewReader(); }
+  // Reset the cached read-only transaction for later renewal.
+  void resetReader() { environment_->resetReader(); }
+  // Check if puts and removes are queued.
+  bool isAsync() const { return environment_->isAsync(); }
+  // Queue a put to the table, adding the key to the Bloom filter.
+  void queuePut(Record* key, Record* value, unsigned int flags) {
+    environment_->queuePut(dbi_, key, value, flags);
+  }
+  // Queue a remove from the table.
+  void queueRemove(Record* key) { environment_->queueRemove(dbi_, key); }
+  // Wait for the queued writes of the environment.
+  void flush() { environment_->flush(); }
+  // Get the raw MDB_env pointer.
+  MDB_env* getEnv() { return environment_->getEnv(); }
+  // Get the raw MDB_dbi pointer.
+  MDB_dbi getDBI() { return dbi_; }
+  // Get the table flags.
+  unsigned int getFlags() const { return flags_; }
+  // Get the ID of the last committed transaction in the environment.
+  size_t getLastTransactionID() {
+    return environment_->getLastTransactionID();
+  }
+  // Get the ordinal index of the records, which is empty until first used.
+  const shared_ptr<OrdinalIndex>& getOrdinalIndex() const {
+    return ordinal_index_;
+  }
+  // Check if the writes keep the ordinal index current.
+  bool isOrdinal() const { return ordinal_; }
+  // Keep the ordinal index current by the writes if true.
+  void setOrdinal(bool ordinal) { ordinal_ = ordinal; }
+  // Get the cached keys of the table, or NULL.
+  const shared_ptr<KeyCache>& getKeyCache() const { return key_cache_; }
+  // Cache the keys of the table.
+  void setKeyCache(const shared_ptr<KeyCache>& cache) { key_cache_ = cache; }
+  // Get the cache of decoded values, or NULL.
+  ValueCache* getValueCache() { return value_cache_.get(); }
+  // Keep up to the number of decoded values, or none if zero.
+  void setValueCache(size_t capacity) {
+    value_cache_.reset((capacity > 0) ? new ValueCache(capacity) : NULL);
+  }
+  // Get the Bloom filter of the keys, or NULL.
+  BloomFilter* getBloomFilter() { return bloom_filter_.get(); }
+  // Keep a Bloom filter of the bits per key, or none if zero. The tables of
+  // the same name in the environment share the filter.
+  void setBloomFilter(double bits_per_key) {
+    if (bits_per_key > 0)
+      bloom_filter_ = environment_->shareBloomFilter(dbi_, bits_per_key);
+    else
+      bloom_filter_.reset();
+  }
+  // Add a written key to the Bloom filter of the table.
+  void addKey(const Record& key) { environment_->addKey(dbi_, key); }
+  // Keep the ID of a transaction committed by this process.
+  void addCommitID(size_t id) { environment_->addCommitID(id); }
+  // Check if the transaction of the ID was committed by this process.
+  bool isOwnCommit(size_t id) { return environment_->isOwnCommit(id); }
+  // Get the keys of the queued puts to the table.
+  void getQueuedKeys(vector<string>* keys) {
+    environment_->getQueuedKeys(dbi_, keys);
+  }
+
+private:
+  // Shared environment.
+  shared_ptr<Environment> environment_;
   // MDB_dbi pointer.
   MDB_dbi dbi_;
+  // Table flags.
+  unsigned int flags_;
+  // Ordinal index of the records of the table.
+  shared_ptr<OrdinalIndex> ordinal_index_;
+  // Flag to keep the ordinal index current by the writes.
+  bool ordinal_;
+  // Cached keys of the table.
+  shared_ptr<KeyCache> key_cache_;
+  // Cached values of the table.
+  unique_ptr<ValueCache> value_cache_;
+  // Bloom filter of the keys of the table.
+  shared_ptr<BloomFilter> bloom_filter_;
 };
 
 // Transaction manager.
 class Transaction {
 public:
   // Create an empty transaction.
-  Transaction() : txn_(NULL), database_(NULL) {}
+  Transaction() : txn_(NULL), database_(NULL), cached_(false),
+                  changed_(false), id_(0) {}
   // Shorthand for constructor-begin.
   Transaction(Database* database, MDB_txn* parent, unsigned int flags) :
-      txn_(NULL), database_(NULL) {
+      txn_(NULL), database_(NULL), cached_(false), changed_(false), id_(0) {
     begin(database, parent, flags);
   }
   virtual ~Transaction() { abort(); }
@@ -129,26 +1186,88 @@ public:
     ASSERT(database, "Null pointer exception.");
     ASSERT(database->getEnv(), "Null pointer exception.");
     abort();
+    // Keep the order of the queued writes and the write transaction.
+    if (!parent && !(flags & MDB_RDONLY))
+      database->flush();
+    txn_ = database->beginTransaction(parent, flags);
     database_ = database;
-    int status = mdb_txn_begin(database_->getEnv(), parent, flags, &txn_);
-    ASSERT(status == MDB_SUCCESS, mdb_strerror(status));
+    // The snapshot of a write transaction is the last commit.
+    if (!(flags & MDB_RDONLY))
+      id_ = database->getLastTransactionID();
   }
-  // Commit the transaction.
-  void commit() {
+  // Begin a read-only transaction reusing the cached one of the database.
+  void renew(Database* database) {
+    ASSERT(database, "Null pointer exception.");
+    abort();
+    txn_ = database->renewReader();
     if (txn_) {
-      int status = mdb_txn_commit(txn_);
-      ASSERT(status == MDB_SUCCESS, mdb_strerror(status));
+      database_ = database;
+      cached_ = true;
+    } else {
+      begin(database, NULL, MDB_RDONLY);
+    }
+  }
+  // Commit the transaction, or return false if the map is full and can grow.
+  bool commit() {
+    int status = MDB_SUCCESS;
+    if (txn_ && cached_) {
+      database_->resetReader();
+    } else if (txn_) {
+      for (size_t i = 0; i < indexed_writes_.size(); ++i) {
+        IndexedWrites& writes = indexed_writes_[i];
+        if (writes.tracked) {
+          status = mdb_stat(txn_, writes.dbi, &writes.stat);
+          ASSERT(status == MDB_SUCCESS, mdb_strerror(status));
+        }
+      }
+      // A failed commit also frees the transaction.
+      status = mdb_txn_commit(txn_);
+      database_->endTransaction();
+      // The keys of the puts are in the Bloom filters.
+      if (status == MDB_SUCCESS && changed_)
+        database_->addCommitID(id_ + 1);
+      // Indexes follow the commit unless another one came in between.
+      if (status == MDB_SUCCESS && !indexed_writes_.empty() &&
+          database_->getLastTransactionID() == id_ + 1) {
+        for (size_t i = 0; i < indexed_writes_.size(); ++i) {
+          IndexedWrites& writes = indexed_writes_[i];
+          if (writes.tracked)
+            writes.index->apply(writes.changes, writes.generation, id_,
+                                writes.stat);
+        }
+      }
     }
     txn_ = NULL;
+    cached_ = false;
+    changed_ = false;
+    indexed_writes_.clear();
+    // Keep the database to grow the map after abort.
+    if (status == MDB_MAP_FULL && database_->canGrow())
+      return false;
     database_ = NULL;
+    ASSERT(status == MDB_SUCCESS, mdb_strerror(status));
+    return true;
   }
   // Abort the transaction.
   void abort() {
-    if (txn_) {
+    if (txn_ && cached_) {
+      database_->resetReader();
+    } else if (txn_) {
       mdb_txn_abort(txn_);
+      database_->endTransaction();
     }
     txn_ = NULL;
     database_ = NULL;
+    cached_ = false;
+    changed_ = false;
+    indexed_writes_.clear();
+  }
+  // Abort the transaction and grow the map after MDB_MAP_FULL.
+  void abortAndGrow() {
+    Database* database = database_;
+    abort();
+    if (database)
+      database->grow();
   }
   // Open database.
   void openDatabase(const string& name, unsigned int flags) {
@@ -156,43 +1275,158 @@ public:
                        (name == "") ? NULL : name.c_str(),
                        flags);
   }
-  // Get the specified database record.
-  bool getRecord(Record* key, Record* value) {
-    int status = mdb_get(txn_, database_->getDBI(), key->get(), value->get());
+  // Get the specified database record. Operations take another table in the
+  // same environment, or use the table of the transaction if NULL.
+  bool getRecord(Record* key, Record* value, Database* table = NULL) {
+    int status = mdb_get(txn_, getDBI(table), key->get(), value->get());
     ASSERT(status == MDB_SUCCESS || status == MDB_NOTFOUND,
            mdb_strerror(status));
     return status == MDB_SUCCESS;
   }
-  // Put a database record.
-  void putRecord(Record* key,
+  // Put a database record, or return false if the map is full and can grow.
+  // With MDB_RESERVE, the value is copied directly into the reserved space.
+  bool putRecord(Record* key,
                  Record* value,
-                 unsigned int flags) {
-    int status = mdb_put(txn_,
-                         database_->getDBI(),
-                         key->get(),
-                         value->get(),
-                         flags);
+                 unsigned int flags,
+                 Database* table = NULL) {
+    MDB_val data = *value->get();
+    size_t entries = prepareWrite(table);
+    int status = mdb_put(txn_, getDBI(table), key->get(), &data, flags);
+    if (status == MDB_MAP_FULL && database_->canGrow())
+      return false;
+    ASSERT(status == MDB_SUCCESS, mdb_strerror(status));
+    if ((flags & MDB_RESERVE) && data.mv_size > 0)
+      memcpy(data.mv_data, value->begin(), data.mv_size);
+    ((table) ? table : database_)->addKey(*key);
+    trackWrite(table, *key->get(), entries);
+    return true;
+  }
+  // Delete the specified database record, or return false if the map is full
+  // and can grow.
+  bool removeRecord(Record* key, Database* table = NULL) {
+    size_t entries = prepareWrite(table);
+    int status = mdb_del(txn_, getDBI(table), key->get(), NULL);
+    if (status == MDB_MAP_FULL && database_->canGrow())
+      return false;
+    ASSERT(status == MDB_SUCCESS, mdb_strerror(status));
+    trackWrite(table, *key->get(), entries);
+    return true;
+  }
+  // Get the number of records in the table before a write, or 0 if the
+  // table was not opened with ORDINAL. An index tagged with an older snapshot
+  // of the same statistics is tagged with this one on the first write of the
+  // table.
+  size_t prepareWrite(Database* table) {
+    MDB_dbi dbi = getDBI(table);
+    if (!((table) ? table : database_)->isOrdinal())
+      return 0;
+    const shared_ptr<OrdinalIndex>& index =
+        ((table) ? table : database_)->getOrdinalIndex();
+    MDB_stat stat;
+    int status = mdb_stat(txn_, dbi, &stat);
+    ASSERT(status == MDB_SUCCESS, mdb_strerror(status));
+    if (!findWrites(index.get())) {
+      if (index->getID() != id_ && index->matches(stat))
+        index->setID(id_);
+      indexed_writes_.push_back(IndexedWrites());
+      IndexedWrites& writes = indexed_writes_.back();
+      writes.index = index;
+      writes.dbi = dbi;
+      writes.tracked = index->getID() == id_;
+      writes.generation = index->getGeneration();
+      if (writes.tracked)
+        writes.changes.assign(index->getKeyCount(), 0);
+    }
+    return stat.ms_entries;
+  }
+  // Keep the write of the key to the table, which had the number of records
+  // from prepareWrite, for the ordinal index to follow at commit.
+  void trackWrite(Database* table, const MDB_val& key, size_t entries) {
+    changed_ = true;
+    if (!((table) ? table : database_)->isOrdinal())
+      return;
+    const shared_ptr<OrdinalIndex>& index =
+        ((table) ? table : database_)->getOrdinalIndex();
+    IndexedWrites* writes = findWrites(index.get());
+    if (!writes || !writes->tracked)
+      return;
+    MDB_stat stat;
+    int status = mdb_stat(txn_, writes->dbi, &stat);
     ASSERT(status == MDB_SUCCESS, mdb_strerror(status));
+    writes->changes[index->find(txn_, writes->dbi, key)] +=
+        static_cast<ptrdiff_t>(stat.ms_entries) -
+        static_cast<ptrdiff_t>(entries);
   }
-  // Delete the specified database record.
-  void removeRecord(Record* key) {
-    int status = mdb_del(txn_, database_->getDBI(), key->get(), NULL);
+  // Compare two keys using the comparison function of the database.
+  int compare(Record* key1, Record* key2) {
+    return mdb_cmp(txn_, database_->getDBI(), key1->get(), key2->get());
+  }
+  // Get the database flags.
+  unsigned int getFlags() {
+    ASSERT(txn_, "Transaction not active.");
+    unsigned int flags = 0;
+    int status = mdb_dbi_flags(txn_, database_->getDBI(), &flags);
     ASSERT(status == MDB_SUCCESS, mdb_strerror(status));
+    return flags;
   }
   // Get the raw transaction pointer.
   MDB_txn* get() { return txn_; }
 
 private:
+  // Writes to a table with an ordinal index.
+  struct IndexedWrites {
+    // Ordinal index of the table.
+    shared_ptr<OrdinalIndex> index;
+    // MDB_dbi of the table.
+    MDB_dbi dbi;
+    // Flag to indicate the index is on the snapshot of the transaction.
+    bool tracked;
+    // Generation of the indexed keys.
+    size_t generation;
+    // Changes of the number of records after each indexed key.
+    vector<ptrdiff_t> changes;
+    // Statistics of the table to commit.
+    MDB_stat stat;
+  };
+
+  // Get the writes to the table of the index, or NULL.
+  IndexedWrites* findWrites(const OrdinalIndex* index) {
+    for (size_t i = 0; i < indexed_writes_.size(); ++i)
+      if (indexed_writes_[i].index.get() == index)
+        return &indexed_writes_[i];
+    return NULL;
+  }
+  // Get the MDB_dbi of the table, or of the transaction if NULL.
+  MDB_dbi getDBI(Database* table) {
+    ASSERT(txn_, "Transaction not active.");
+    if (!table)
+      return database_->getDBI();
+    ASSERT(table->getEnv() == database_->getEnv(),
+           "Table must be in the environment of the transaction.");
+    return table->getDBI();
+  }
+
   // MDB_txn pointer.
   MDB_txn* txn_;
   // Database pointer.
   Database* database_;
+  // Flag to indicate the cached read-only transaction of the database.
+  bool cached_;
+  // Flag to indicate records were put or deleted.
+  bool changed_;
+  // Transaction ID of the snapshot of the write transaction.
+  size_t id_;
+  // Writes to the tables with ordinal indexes.
+  vector<IndexedWrites> indexed_writes_;
 };
 
 // Cursor container.
 class Cursor {
 public:
-  Cursor() : cursor_(NULL) {}
+  Cursor() : cursor_(NULL), transaction_(NULL), table_(NULL) {}
+  // Take over the opened cursor.
+  explicit Cursor(MDB_cursor* cursor) :
+      cursor_(cursor), transaction_(NULL), table_(NULL) {}
   virtual ~Cursor() { close(); }
   // Open the cursor.
   void open(MDB_txn *txn, MDB_dbi dbi) {
@@ -200,111 +1434,2301 @@ public:
     int status = mdb_cursor_open(txn, dbi, &cursor_);
     ASSERT(status == MDB_SUCCESS, mdb_strerror(status));
   }
+  // Open the cursor on the table in the transaction, which keeps the writes
+  // of the cursor for the indexes of the table.
+  void open(Transaction* transaction, Database* table) {
+    open(transaction->get(), table->getDBI());
+    transaction_ = transaction;
+    table_ = table;
+  }
   // Close the cursor.
   void close() {
     if (cursor_)
       mdb_cursor_close(cursor_);
     cursor_ = NULL;
+    transaction_ = NULL;
+    table_ = NULL;
+  }
+  // Apply the cursor operation and get the value.
+  bool get(MDB_cursor_op operation) {
+    int status = mdb_cursor_get(cursor_, key_.get(), value_.get(), operation);
+    ASSERT(status == MDB_SUCCESS || status == MDB_NOTFOUND,
+           mdb_strerror(status));
+    return status == MDB_SUCCESS;
+  }
+  // Put the current key and value. With MDB_RESERVE, the value is copied
+  // directly into the reserved space.
+  void put(unsigned int flags) {
+    MDB_val data = *value_.get();
+    size_t entries = (transaction_) ? transaction_->prepareWrite(table_) : 0;
+    int status = mdb_cursor_put(cursor_, key_.get(), &data, flags);
+    ASSERT(status == MDB_SUCCESS, mdb_strerror(status));
+    if ((flags & MDB_RESERVE) && data.mv_size > 0)
+      memcpy(data.mv_data, value_.begin(), data.mv_size);
+    if (transaction_) {
+      table_->addKey(key_);
+      transaction_->trackWrite(table_, *key_.get(), entries);
+    }
+  }
+  // Put the records of the given size as duplicates of the current key with
+  // MDB_MULTIPLE, and return the number of the written records.
+  size_t putMultiple(const void* data,
+                     size_t size,
+                     size_t count,
+                     unsigned int flags) {
+    ASSERT(getFlags() & MDB_DUPFIXED, "MULTIPLE requires DUPFIXED.");
+    MDB_val values[2];
+    values[0].mv_size = size;
+    values[0].mv_data = const_cast<void*>(data);
+    values[1].mv_size = count;
+    values[1].mv_data = NULL;
+    size_t entries = (transaction_) ? transaction_->prepareWrite(table_) : 0;
+    int status = mdb_cursor_put(cursor_, key_.get(), values,
+                                flags | MDB_MULTIPLE);
+    ASSERT(status == MDB_SUCCESS, mdb_strerror(status));
+    if (transaction_) {
+      table_->addKey(key_);
+      transaction_->trackWrite(table_, *key_.get(), entries);
+    }
+    return values[1].mv_size;
+  }
+  // Delete the current key and value.
+  void remove(unsigned int flags) {
+    size_t entries = 0;
+    string key;
+    if (transaction_) {
+      entries = transaction_->prepareWrite(table_);
+      MDB_val current_key, current_value;
+      if (mdb_cursor_get(cursor_, &current_key, &current_value,
+                         MDB_GET_CURRENT) == MDB_SUCCESS)
+        key.assign(static_cast<const char*>(current_key.mv_data),
+                   current_key.mv_size);
+    }
+    int status = mdb_cursor_del(cursor_, flags);
+    ASSERT(status == MDB_SUCCESS, mdb_strerror(status));
+    if (transaction_) {
+      MDB_val removed_key = {key.size(), const_cast<char*>(key.data())};
+      transaction_->trackWrite(table_, removed_key, entries);
+    }
+  }
+  // Get the number of duplicates of the current key.
+  size_t count() {
+    size_t count = 0;
+    int status = mdb_cursor_count(cursor_, &count);
+    ASSERT(status == MDB_SUCCESS, mdb_strerror(status));
+    return count;
+  }
+  // Get the database flags.
+  unsigned int getFlags() {
+    unsigned int flags = 0;
+    int status = mdb_dbi_flags(mdb_cursor_txn(cursor_),
+                               mdb_cursor_dbi(cursor_),
+                               &flags);
+    ASSERT(status == MDB_SUCCESS, mdb_strerror(status));
+    return flags;
+  }
+  // Compare two keys using the comparison function of the database.
+  int compare(Record* key1, Record* key2) {
+    return mdb_cmp(mdb_cursor_txn(cursor_),
+                   mdb_cursor_dbi(cursor_),
+                   key1->get(),
+                   key2->get());
+  }
+  // Get the raw cursor.
+  MDB_cursor* get() { return cursor_; }
+  // Get the raw record.
+  Record* getKey() { return &key_; }
+  // Get the raw record.
+  Record* getValue() { return &value_; }
+
+private:
+  // MDB_cursor pointer.
+  MDB_cursor* cursor_;
+  // Transaction that keeps the writes, or NULL.
+  Transaction* transaction_;
+  // Table of the cursor in the transaction.
+  Database* table_;
+  // Key.
+  Record key_;
+  // Value.
+  Record value_;
+};
+
+// Pool of worker threads that run the same task at once. Tasks must not call
+// the MEX API, which is only safe in the MATLAB thread.
+class WorkerPool {
+public:
+  // Start the worker threads.
+  explicit WorkerPool(size_t size) :
+      generation_(0), pending_(0), stopped_(false) {
+    for (size_t i = 0; i < size; ++i)
+      threads_.push_back(thread(&WorkerPool::work, this, i));
+  }
+  // Stop the worker threads.
+  virtual ~WorkerPool() {
+    {
+      lock_guard<mutex> lock(mutex_);
+      stopped_ = true;
+    }
+    start_.notify_all();
+    for (size_t i = 0; i < threads_.size(); ++i)
+      threads_[i].join();
+  }
+  // Get the number of the worker threads.
+  size_t size() const { return threads_.size(); }
+  // Run the task with the index of each worker, and wait for all of them.
+  void run(const function<void(size_t)>& task) {
+    unique_lock<mutex> lock(mutex_);
+    task_ = task;
+    pending_ = threads_.size();
+    ++generation_;
+    start_.notify_all();
+    done_.wait(lock, [this] { return pending_ == 0; });
+  }
+  // Run the function over indices from 0 to size - 1 split across workers.
+  void parallelFor(size_t size, const function<void(size_t)>& body) {
+    const size_t kBlockSize = 256;
+    atomic<size_t> next(0);
+    run([&](size_t) {
+      for (size_t begin = next.fetch_add(kBlockSize);
+           begin < size;
+           begin = next.fetch_add(kBlockSize)) {
+        size_t end = min(begin + kBlockSize, size);
+        for (size_t i = begin; i < end; ++i)
+          body(i);
+      }
+    });
+  }
+
+private:
+  // Loop of a worker thread.
+  void work(size_t index) {
+    size_t generation = 0;
+    while (true) {
+      function<void(size_t)> task;
+      {
+        unique_lock<mutex> lock(mutex_);
+        start_.wait(lock, [&] {
+          return stopped_ || generation_ != generation;
+        });
+        if (stopped_)
+          return;
+        generation = generation_;
+        task = task_;
+      }
+      task(index);
+      {
+        lock_guard<mutex> lock(mutex_);
+        if (--pending_ == 0)
+          done_.notify_one();
+      }
+    }
+  }
+
+  // Worker threads.
+  vector<thread> threads_;
+  // Task to run.
+  function<void(size_t)> task_;
+  // Counter of the tasks given to the workers.
+  size_t generation_;
+  // Number of workers running the task.
+  size_t pending_;
+  // Flag to stop the workers.
+  bool stopped_;
+  // Mutex for the task.
+  mutex mutex_;
+  // Condition to start a task.
+  condition_variable start_;
+  // Condition to finish a task.
+  condition_variable done_;
+};
+
+// Create a directory.
+void createDirectoryIfNotExist(const mxArray* filename) {
+  MxArray flag("dir");
+  mxArray* prhs[] = {const_cast<mxArray*>(filename),
+                     const_cast<mxArray*>(flag.get())};
+  mxArray* plhs;
+  ASSERT(mexCallMATLAB(1, &plhs, 2, prhs, "exist") == 0,
+         "Failed to check a directory.");
+  MxArray status(plhs);
+  if (!status.to<bool>())
+    ASSERT(mexCallMATLAB(0, NULL, 1, prhs, "mkdir") == 0,
+           "Failed to create a directory.");
+}
+
+} // namespace
+
+namespace mexplus {
+
+// Template specialization of mxArray* to Record.
+template <>
+void MxArray::to(const mxArray* array, Record* value) {
+  ASSERT(value, "Null pointer exception.");
+  value->initialize(array);
+}
+
+// Template specialization of Record to mxArray*.
+template <>
+mxArray* MxArray::from(const Record& value) {
+  return MxArray(string(value.begin(), value.end())).release();
+}
+
+// Template specialization of MDB_stat to mxArray*.
+template <>
+mxArray* MxArray::from(const MDB_stat& stat) {
+  MxArray value(Struct());
+  value.set("psize", stat.ms_psize);
+  value.set("depth", stat.ms_depth);
+  value.set("branch_pages", stat.ms_branch_pages);
+  value.set("leaf_pages", stat.ms_leaf_pages);
+  value.set("overflow_pages", stat.ms_overflow_pages);
+  value.set("entries", stat.ms_entries);
+  return value.release();
+}
+
+// Session instance storage.
+template class Session<Database>;
+template class Session<Transaction>;
+template class Session<Cursor>;
+
+} // namespace mexplus
+
+namespace {
+
+// Get the number of keys in a cell array, a numeric array, or a single char.
+mwSize getKeySize(const mxArray* keys) {
+  return (mxIsChar(keys)) ? 1 : mxGetNumberOfElements(keys);
+}
+
+// Check if the machine is little-endian.
+bool isLittleEndian() {
+  const uint16_t probe = 1;
+  return *reinterpret_cast<const uint8_t*>(&probe) == 1;
+}
+
+// Check if the class is of integer keys.
+bool isIntegerKey(mxClassID class_id) {
+  return class_id == mxUINT32_CLASS || class_id == mxUINT64_CLASS ||
+         class_id == mxINT64_CLASS;
+}
+
+// Convert an integer in place between the native byte order and the key
+// bytes. INTEGERKEY tables compare the native integers. Other tables compare
+// bytes, so the key is big-endian with the sign bit of int64 flipped.
+void convertIntegerKey(char* bytes,
+                       size_t size,
+                       mxClassID class_id,
+                       unsigned int flags,
+                       bool encode) {
+  if (flags & MDB_INTEGERKEY)
+    return;
+  if (class_id == mxINT64_CLASS && !encode)
+    bytes[0] ^= 0x80;
+  if (isLittleEndian())
+    reverse(bytes, bytes + size);
+  if (class_id == mxINT64_CLASS && encode)
+    bytes[0] ^= 0x80;
+}
+
+// Get the index-th integer of a uint32, uint64, or int64 array as key bytes.
+void getIntegerKey(const mxArray* array,
+                   mwIndex index,
+                   unsigned int flags,
+                   Record* key) {
+  size_t size = mxGetElementSize(array);
+  const char* data = static_cast<const char*>(mxGetData(array));
+  string bytes(data + index * size, data + (index + 1) * size);
+  convertIntegerKey(&bytes[0], size, mxGetClassID(array), flags, true);
+  key->swap(&bytes);
+}
+
+// Get a single key of put, get, remove, the cursor, and each element of a
+// cell array of keys. A uint32, uint64, or int64 scalar is encoded by
+// convertIntegerKey, and other numeric arrays are narrowed element by element
+// to chars, which keeps the keys written by the earlier versions readable.
+void getSingleKey(const mxArray* array, unsigned int flags, Record* key) {
+  ASSERT(key, "Null pointer exception.");
+  ASSERT(array, "Null pointer exception.");
+  if (isIntegerKey(mxGetClassID(array))) {
+    ASSERT(mxGetNumberOfElements(array) == 1 && !mxIsComplex(array),
+           "%s key must be a real scalar.", mxGetClassName(array));
+    getIntegerKey(array, 0, flags, key);
+  } else if (mxIsNumeric(array) || mxIsLogical(array)) {
+    key->initialize(MxArray(array).to<string>());
+  } else {
+    ASSERT(mxIsChar(array), "Invalid key type: %s.",
+           mxGetClassName(array));
+    key->initialize(array);
+  }
+}
+
+// Get the index-th key from a cell array, a numeric array, or a single char,
+// in the format of the table flags. Each element of a cell array is a key of
+// getSingleKey. uint32, uint64, and int64 arrays are encoded by
+// convertIntegerKey, and the elements of other numeric arrays are formatted
+// in the same way as num2str.
+void getKey(const mxArray* keys,
+            mwIndex index,
+            unsigned int flags,
+            Record* key) {
+  ASSERT(key, "Null pointer exception.");
+  if (mxIsCell(keys)) {
+    const mxArray* element = mxGetCell(keys, index);
+    ASSERT(element && !mxIsCell(element), "Invalid key type.");
+    getSingleKey(element, flags, key);
+  } else if (isIntegerKey(mxGetClassID(keys)) && !mxIsComplex(keys)) {
+    getIntegerKey(keys, index, flags, key);
+  } else if (mxIsNumeric(keys) || mxIsLogical(keys)) {
+    double number = MxArray::at<double>(keys, index);
+    char buffer[64];
+    if (std::isnan(number)) {
+      snprintf(buffer, sizeof(buffer), "NaN");
+    } else if (std::isinf(number)) {
+      snprintf(buffer, sizeof(buffer), (number > 0) ? "Inf" : "-Inf");
+    } else if (number == floor(number)) {
+      // Print -0 as 0.
+      snprintf(buffer, sizeof(buffer), "%.0f", (number == 0) ? 0.0 : number);
+    } else {
+      // Keep at least 5 and at most 16 significant digits.
+      int digits = static_cast<int>(floor(log10(fabs(number)))) + 5;
+      snprintf(buffer, sizeof(buffer), "%.*g",
+               (digits < 5) ? 5 : (digits > 16) ? 16 : digits, number);
+    }
+    key->initialize(string(buffer));
+  } else {
+    ASSERT(mxIsChar(keys) && index == 0, "Invalid key type: %s.",
+           mxGetClassName(keys));
+    key->initialize(keys);
+  }
+}
+
+// Create a row cell array from mxArray pointers.
+mxArray* createCell(const vector<mxArray*>& elements) {
+  MxArray cell(MxArray::Cell(1, elements.size()));
+  for (size_t i = 0; i < elements.size(); ++i)
+    cell.set(i, elements[i]);
+  return cell.release();
+}
+
+// Self-describing binary codec of MATLAB arrays. An encoded array starts with
+// a header of the class ID, the complexity, and the dimensions, followed by
+// the raw column-major data of a numeric, logical, or char array, or by the
+// encoded elements of a cell or struct array. Struct arrays also store the
+// field names. Multi-byte values are in the native byte order.
+class Serializer {
+public:
+  // Encode the array into the buffer.
+  static void encode(const mxArray* array, string* buffer) {
+    ASSERT(buffer, "Null pointer exception.");
+    buffer->clear();
+    buffer->reserve(getEncodedSize(array) + 1);
+    buffer->push_back(kVersion);
+    write(array, buffer);
+  }
+  // Decode the array from the buffer.
+  static mxArray* decode(const char* data, size_t size) {
+    ASSERT(size > 0 && *data == kVersion, "Invalid serialized record.");
+    const char* end = data + size;
+    ++data;
+    mxArray* array = read(&data, end);
+    ASSERT(data == end, "Invalid serialized record.");
+    return array;
+  }
+
+private:
+  // Format version stored at the beginning of the encoded buffer.
+  static const char kVersion = 1;
+
+  // Get the number of bytes of the encoded array.
+  static size_t getEncodedSize(const mxArray* array) {
+    if (!array)
+      return 3;
+    size_t size = 3 + mxGetNumberOfDimensions(array) * sizeof(uint64_t);
+    mwSize elements = mxGetNumberOfElements(array);
+    if (mxIsCell(array)) {
+      for (mwIndex i = 0; i < elements; ++i)
+        size += getEncodedSize(mxGetCell(array, i));
+    } else if (mxIsStruct(array)) {
+      int fields = mxGetNumberOfFields(array);
+      size += sizeof(uint32_t);
+      for (int j = 0; j < fields; ++j)
+        size += 1 + strlen(mxGetFieldNameByNumber(array, j));
+      for (mwIndex i = 0; i < elements; ++i)
+        for (int j = 0; j < fields; ++j)
+          size += getEncodedSize(mxGetFieldByNumber(array, i, j));
+    } else {
+      size += elements * mxGetElementSize(array) *
+              ((mxIsComplex(array)) ? 2 : 1);
+    }
+    return size;
+  }
+  // Append raw bytes to the buffer.
+  template <typename T>
+  static void append(const T& value, string* buffer) {
+    buffer->append(reinterpret_cast<const char*>(&value), sizeof(T));
+  }
+  // Append the encoded array to the buffer. An unset cell or field is
+  // encoded as an empty double array.
+  static void write(const mxArray* array, string* buffer) {
+    if (!array) {
+      const uint8_t header[] = {mxDOUBLE_CLASS, 0, 0};
+      buffer->append(reinterpret_cast<const char*>(header), sizeof(header));
+      return;
+    }
+    mxClassID class_id = mxGetClassID(array);
+    ASSERT(!mxIsSparse(array) &&
+           (class_id == mxCELL_CLASS || class_id == mxSTRUCT_CLASS ||
+            class_id == mxLOGICAL_CLASS || class_id == mxCHAR_CLASS ||
+            mxIsNumeric(array)),
+           "Unsupported type for serialization: %s.",
+           mxGetClassName(array));
+    mwSize dimensions = mxGetNumberOfDimensions(array);
+    ASSERT(dimensions < 256, "Too many dimensions to serialize.");
+    append(static_cast<uint8_t>(class_id), buffer);
+    append(static_cast<uint8_t>(mxIsComplex(array)), buffer);
+    append(static_cast<uint8_t>(dimensions), buffer);
+    for (mwIndex i = 0; i < dimensions; ++i)
+      append(static_cast<uint64_t>(mxGetDimensions(array)[i]), buffer);
+    mwSize elements = mxGetNumberOfElements(array);
+    if (class_id == mxCELL_CLASS) {
+      for (mwIndex i = 0; i < elements; ++i)
+        write(mxGetCell(array, i), buffer);
+    } else if (class_id == mxSTRUCT_CLASS) {
+      int fields = mxGetNumberOfFields(array);
+      append(static_cast<uint32_t>(fields), buffer);
+      for (int j = 0; j < fields; ++j) {
+        const char* name = mxGetFieldNameByNumber(array, j);
+        append(static_cast<uint8_t>(strlen(name)), buffer);
+        buffer->append(name);
+      }
+      for (mwIndex i = 0; i < elements; ++i)
+        for (int j = 0; j < fields; ++j)
+          write(mxGetFieldByNumber(array, i, j), buffer);
+    } else {
+      size_t size = elements * mxGetElementSize(array);
+      if (size > 0) {
+        buffer->append(reinterpret_cast<const char*>(mxGetData(array)), size);
+        if (mxIsComplex(array))
+          buffer->append(reinterpret_cast<const char*>(mxGetImagData(array)),
+                         size);
+      }
+    }
+  }
+  // Read raw bytes from the buffer.
+  static void take(const char** data, const char* end, void* output,
+                   size_t size) {
+    ASSERT(static_cast<size_t>(end - *data) >= size,
+           "Invalid serialized record.");
+    if (size > 0)
+      memcpy(output, *data, size);
+    *data += size;
+  }
+  // Read the encoded array from the buffer.
+  static mxArray* read(const char** data, const char* end) {
+    uint8_t header[3];
+    take(data, end, header, sizeof(header));
+    mxClassID class_id = static_cast<mxClassID>(header[0]);
+    mxComplexity complexity = (header[1]) ? mxCOMPLEX : mxREAL;
+    vector<mwSize> dimensions(header[2]);
+    for (size_t i = 0; i < dimensions.size(); ++i) {
+      uint64_t dimension;
+      take(data, end, &dimension, sizeof(dimension));
+      dimensions[i] = dimension;
+    }
+    if (dimensions.empty())
+      dimensions.assign(2, 0);
+    mxArray* array = NULL;
+    if (class_id == mxCELL_CLASS) {
+      array = mxCreateCellArray(dimensions.size(), &dimensions[0]);
+      MEXPLUS_CHECK_NOTNULL(array);
+      mwSize elements = mxGetNumberOfElements(array);
+      for (mwIndex i = 0; i < elements; ++i)
+        mxSetCell(array, i, read(data, end));
+    } else if (class_id == mxSTRUCT_CLASS) {
+      uint32_t fields;
+      take(data, end, &fields, sizeof(fields));
+      vector<string> names(fields);
+      vector<const char*> name_pointers(fields);
+      for (uint32_t j = 0; j < fields; ++j) {
+        uint8_t length;
+        take(data, end, &length, sizeof(length));
+        names[j].resize(length);
+        take(data, end, &names[j][0], length);
+        name_pointers[j] = names[j].c_str();
+      }
+      array = mxCreateStructArray(dimensions.size(),
+                                  &dimensions[0],
+                                  fields,
+                                  (fields) ? &name_pointers[0] : NULL);
+      MEXPLUS_CHECK_NOTNULL(array);
+      mwSize elements = mxGetNumberOfElements(array);
+      for (mwIndex i = 0; i < elements; ++i)
+        for (uint32_t j = 0; j < fields; ++j)
+          mxSetFieldByNumber(array, i, j, read(data, end));
+    } else {
+      if (class_id == mxCHAR_CLASS)
+        array = mxCreateCharArray(dimensions.size(), &dimensions[0]);
+      else if (class_id == mxLOGICAL_CLASS)
+        array = mxCreateLogicalArray(dimensions.size(), &dimensions[0]);
+      else {
+        ASSERT(class_id >= mxDOUBLE_CLASS && class_id <= mxUINT64_CLASS,
+               "Invalid serialized record.");
+        array = mxCreateUninitNumericArray(dimensions.size(),
+                                           &dimensions[0],
+                                           class_id,
+                                           complexity);
+      }
+      MEXPLUS_CHECK_NOTNULL(array);
+      size_t size = mxGetNumberOfElements(array) * mxGetElementSize(array);
+      take(data, end, mxGetData(array), size);
+      if (mxIsComplex(array))
+        take(data, end, mxGetImagData(array), size);
+    }
+    return array;
+  }
+};
+
+// Order-preserving codec of tuple keys. A tuple is a cell array of numeric or
+// logical scalars and char rows. Each field is encoded as its class ID and its
+// big-endian bytes, where signed integers flip the sign bit, and floating
+// points flip the sign bit if positive or all the bits if negative. A char row
+// encodes each UTF-16 code unit in UTF-8, which keeps the order of the code
+// units, escapes 0x00 as 0x00 0xFF, and ends with 0x00. Comparing the encoded
+// bytes compares the fields in order, and a tuple is a prefix of the tuples
+// that extend it, so that PREFIX seeks the tuples starting with the leading
+// fields.
+class TupleCodec {
+public:
+  // Encode the tuple into the buffer.
+  static void encode(const mxArray* tuple, string* buffer) {
+    ASSERT(buffer, "Null pointer exception.");
+    ASSERT(mxIsCell(tuple), "Tuple must be a cell array.");
+    buffer->clear();
+    for (mwIndex i = 0; i < mxGetNumberOfElements(tuple); ++i) {
+      const mxArray* field = mxGetCell(tuple, i);
+      ASSERT(field, "Tuple field must not be empty.");
+      mxClassID class_id = mxGetClassID(field);
+      buffer->push_back(static_cast<char>(class_id));
+      if (class_id == mxCHAR_CLASS) {
+        ASSERT(mxGetM(field) <= 1, "Tuple char field must be a row.");
+        const mxChar* chars = mxGetChars(field);
+        for (mwIndex j = 0; j < mxGetNumberOfElements(field); ++j)
+          encodeChar(chars[j], buffer);
+        buffer->push_back(0);
+      } else {
+        ASSERT((mxIsNumeric(field) || mxIsLogical(field)) &&
+               !mxIsComplex(field) && !mxIsSparse(field) &&
+               mxGetNumberOfElements(field) == 1,
+               "Invalid tuple field: %s.", mxGetClassName(field));
+        size_t size = mxGetElementSize(field);
+        const char* data = static_cast<const char*>(mxGetData(field));
+        string bytes(data, data + size);
+        convert(&bytes[0], size, class_id, true);
+        buffer->append(bytes);
+      }
+    }
+  }
+  // Decode the tuple into a row cell array.
+  static mxArray* decode(const char* data, size_t size) {
+    const char* end = data + size;
+    vector<mxArray*> fields;
+    while (data < end) {
+      mxClassID class_id = static_cast<mxClassID>(*data++);
+      if (class_id == mxCHAR_CLASS) {
+        vector<mxChar> chars;
+        while (true) {
+          ASSERT(data < end, "Invalid tuple key.");
+          if (*data == 0 && (data + 1 == end ||
+                             *(data + 1) != static_cast<char>(0xFF))) {
+            ++data;
+            break;
+          }
+          chars.push_back(decodeChar(&data, end));
+        }
+        const mwSize dimensions[] = {1, chars.size()};
+        mxArray* field = mxCreateCharArray(2, dimensions);
+        MEXPLUS_CHECK_NOTNULL(field);
+        if (!chars.empty())
+          std::copy(chars.begin(), chars.end(), mxGetChars(field));
+        fields.push_back(field);
+      } else {
+        ASSERT(class_id == mxLOGICAL_CLASS ||
+               (class_id >= mxDOUBLE_CLASS && class_id <= mxUINT64_CLASS),
+               "Invalid tuple key.");
+        mxArray* field = (class_id == mxLOGICAL_CLASS) ?
+            mxCreateLogicalMatrix(1, 1) :
+            mxCreateNumericMatrix(1, 1, class_id, mxREAL);
+        MEXPLUS_CHECK_NOTNULL(field);
+        size_t field_size = mxGetElementSize(field);
+        ASSERT(static_cast<size_t>(end - data) >= field_size,
+               "Invalid tuple key.");
+        char* field_data = static_cast<char*>(mxGetData(field));
+        std::copy(data, data + field_size, field_data);
+        convert(field_data, field_size, class_id, false);
+        data += field_size;
+        fields.push_back(field);
+      }
+    }
+    return createCell(fields);
+  }
+
+private:
+  // Encode a UTF-16 code unit in UTF-8, escaping 0x00 as 0x00 0xFF.
+  static void encodeChar(mxChar value, string* buffer) {
+    if (value == 0) {
+      buffer->push_back(0);
+      buffer->push_back(static_cast<char>(0xFF));
+    } else if (value < 0x80) {
+      buffer->push_back(static_cast<char>(value));
+    } else if (value < 0x800) {
+      buffer->push_back(static_cast<char>(0xC0 | (value >> 6)));
+      buffer->push_back(static_cast<char>(0x80 | (value & 0x3F)));
+    } else {
+      buffer->push_back(static_cast<char>(0xE0 | (value >> 12)));
+      buffer->push_back(static_cast<char>(0x80 | ((value >> 6) & 0x3F)));
+      buffer->push_back(static_cast<char>(0x80 | (value & 0x3F)));
+    }
+  }
+  // Decode a UTF-16 code unit encoded by encodeChar, and advance the data.
+  static mxChar decodeChar(const char** data, const char* end) {
+    const unsigned char* bytes = reinterpret_cast<const unsigned char*>(*data);
+    size_t size = (bytes[0] == 0) ? 2 : (bytes[0] < 0x80) ? 1 :
+                  ((bytes[0] & 0xE0) == 0xC0) ? 2 :
+                  ((bytes[0] & 0xF0) == 0xE0) ? 3 : 0;
+    ASSERT(size > 0 && static_cast<size_t>(end - *data) >= size,
+           "Invalid tuple key.");
+    *data += size;
+    if (size == 1 || bytes[0] == 0)
+      return bytes[0];
+    if (size == 2)
+      return ((bytes[0] & 0x1F) << 6) | (bytes[1] & 0x3F);
+    return ((bytes[0] & 0x0F) << 12) | ((bytes[1] & 0x3F) << 6) |
+           (bytes[2] & 0x3F);
+  }
+  // Convert a scalar in place between the native bytes and the ordered bytes.
+  static void convert(char* bytes, size_t size, mxClassID class_id,
+                      bool encode) {
+    bool is_signed = class_id == mxINT8_CLASS || class_id == mxINT16_CLASS ||
+                     class_id == mxINT32_CLASS || class_id == mxINT64_CLASS;
+    bool is_float = class_id == mxDOUBLE_CLASS || class_id == mxSINGLE_CLASS;
+    if (encode && isLittleEndian())
+      reverse(bytes, bytes + size);
+    if (is_signed) {
+      bytes[0] ^= 0x80;
+    } else if (is_float) {
+      // Encoded positive values have the sign bit set.
+      bool negative = (encode) ? (bytes[0] & 0x80) : !(bytes[0] & 0x80);
+      if (negative) {
+        for (size_t i = 0; i < size; ++i)
+          bytes[i] = ~bytes[i];
+      } else {
+        bytes[0] ^= 0x80;
+      }
+    }
+    if (!encode && isLittleEndian())
+      reverse(bytes, bytes + size);
+  }
+};
+
+// Value format to decode a record into mxArray. TYPE specifies the class of
+// the array, and SIZE optionally specifies the dimensions. Numeric records are
+// copied as raw bytes in the native byte order. SERIALIZE decodes a record
+// written by Serializer regardless of TYPE and SIZE.
+class ValueFormat {
+public:
+  // Create a char format.
+  ValueFormat() : class_id_(mxCHAR_CLASS), element_size_(1),
+                  serialize_(false) {}
+  // Create a format from TYPE, SIZE, and SERIALIZE options.
+  ValueFormat(const InputArguments& input) :
+      class_id_(mxCHAR_CLASS),
+      element_size_(1),
+      dimensions_(input.get<vector<mwSize> >("SIZE", vector<mwSize>())),
+      serialize_(input.get<bool>("SERIALIZE", false)) {
+    setClass(input.get<string>("TYPE", "char"));
+  }
+  // Create a format of the class name.
+  explicit ValueFormat(const string& type) :
+      class_id_(mxCHAR_CLASS), element_size_(1), serialize_(false) {
+    setClass(type);
+  }
+  virtual ~ValueFormat() {}
+  // Decode the record. A missing record is decoded as an empty array.
+  mxArray* decode(const Record& value) const {
+    mxArray* array = create(value);
+    copy(value, array);
+    return array;
+  }
+  // Create an array for the record without copying the data. A serialized
+  // record is fully decoded here.
+  mxArray* create(const Record& value) const {
+    mwSize size = value.end() - value.begin();
+    mxArray* array = NULL;
+    if (serialize_) {
+      return (size > 0) ? Serializer::decode(value.begin(), size) :
+                          mxCreateDoubleMatrix(0, 0, mxREAL);
+    } else if (class_id_ == mxCHAR_CLASS) {
+      const mwSize dimensions[] = {1, size};
+      array = mxCreateCharArray(2, dimensions);
+    } else {
+      ASSERT(size % element_size_ == 0,
+             "Record of %d bytes is not a multiple of %d-byte elements.",
+             static_cast<int>(size),
+             static_cast<int>(element_size_));
+      const mwSize dimensions[] = {1, size / element_size_};
+      array = (class_id_ == mxLOGICAL_CLASS) ?
+          mxCreateLogicalArray(2, dimensions) :
+          mxCreateUninitNumericArray(2, dimensions, class_id_, mxREAL);
+    }
+    MEXPLUS_CHECK_NOTNULL(array);
+    if (!dimensions_.empty() && size > 0) {
+      mwSize elements = 1;
+      for (size_t i = 0; i < dimensions_.size(); ++i)
+        elements *= dimensions_[i];
+      ASSERT(elements == mxGetNumberOfElements(array),
+             "SIZE does not match the %d elements in the record.",
+             static_cast<int>(mxGetNumberOfElements(array)));
+      ASSERT(mxSetDimensions(array, &dimensions_[0], dimensions_.size()) == 0,
+             "Failed to set dimensions.");
+    }
+    return array;
+  }
+  // Create a matrix whose columns are records of the given size without
+  // copying the data.
+  mxArray* createColumns(size_t size, size_t columns) const {
+    ASSERT(!serialize_, "SERIALIZE is not supported.");
+    ASSERT(size % element_size_ == 0,
+           "Record of %d bytes is not a multiple of %d-byte elements.",
+           static_cast<int>(size),
+           static_cast<int>(element_size_));
+    const mwSize dimensions[] = {size / element_size_, columns};
+    mxArray* array = (class_id_ == mxCHAR_CLASS) ?
+        mxCreateCharArray(2, dimensions) : (class_id_ == mxLOGICAL_CLASS) ?
+        mxCreateLogicalArray(2, dimensions) :
+        mxCreateUninitNumericArray(2, dimensions, class_id_, mxREAL);
+    MEXPLUS_CHECK_NOTNULL(array);
+    return array;
+  }
+  // Copy the data of the record into the array made by create, starting at
+  // the byte offset. This does not call the MEX API other than data
+  // accessors, and is safe in any thread.
+  void copy(const Record& value, mxArray* array, size_t offset = 0) const {
+    size_t size = value.end() - value.begin();
+    if (serialize_ || size == 0) {
+      return;
+    } else if (class_id_ == mxCHAR_CLASS) {
+      const unsigned char* input =
+          reinterpret_cast<const unsigned char*>(value.begin());
+      std::copy(input, input + size, mxGetChars(array) + offset);
+    } else {
+      memcpy(static_cast<char*>(mxGetData(array)) + offset,
+             value.begin(),
+             size);
+    }
+  }
+  // Get the bytes that identify the format, to cache the decoded values.
+  string getSignature() const {
+    string signature(reinterpret_cast<const char*>(&class_id_),
+                     sizeof(class_id_));
+    signature.push_back((serialize_) ? 1 : 0);
+    size_t size = dimensions_.size();
+    signature.append(reinterpret_cast<const char*>(&size), sizeof(size));
+    if (size > 0)
+      signature.append(reinterpret_cast<const char*>(&dimensions_[0]),
+                       size * sizeof(mwSize));
+    return signature;
+  }
+
+private:
+  // Set the class ID and the element size from the class name.
+  void setClass(const string& name) {
+    const struct {
+      const char* name;
+      mxClassID class_id;
+      size_t element_size;
+    } kClasses[] = {
+      {"char", mxCHAR_CLASS, 1},
+      {"logical", mxLOGICAL_CLASS, sizeof(mxLogical)},
+      {"int8", mxINT8_CLASS, 1},
+      {"uint8", mxUINT8_CLASS, 1},
+      {"int16", mxINT16_CLASS, 2},
+      {"uint16", mxUINT16_CLASS, 2},
+      {"int32", mxINT32_CLASS, 4},
+      {"uint32", mxUINT32_CLASS, 4},
+      {"int64", mxINT64_CLASS, 8},
+      {"uint64", mxUINT64_CLASS, 8},
+      {"single", mxSINGLE_CLASS, 4},
+      {"double", mxDOUBLE_CLASS, 8}};
+    for (size_t i = 0; i < sizeof(kClasses) / sizeof(kClasses[0]); ++i) {
+      if (name == kClasses[i].name) {
+        class_id_ = kClasses[i].class_id;
+        element_size_ = kClasses[i].element_size;
+        return;
+      }
+    }
+    ERROR("Invalid TYPE: %s.", name.c_str());
+  }
+
+  // Class of the array.
+  mxClassID class_id_;
+  // Size of an array element in bytes.
+  size_t element_size_;
+  // Dimensions of the array, or empty for a row vector.
+  vector<mwSize> dimensions_;
+  // Flag to decode serialized records.
+  bool serialize_;
+};
+
+// Key format of the KEYTYPE option, which is char by default, uint32,
+// uint64, or int64 to decode the keys made by getKey from integers, or tuple
+// to decode the keys made by TupleCodec into cell arrays.
+class KeyFormat {
+public:
+  // Create a char format.
+  KeyFormat() : class_id_(mxCHAR_CLASS), flags_(0), packed_(false) {}
+  // Create a format from the KEYTYPE option and the table flags. Packed char
+  // keys are decoded into the rows of a char matrix padded with spaces.
+  KeyFormat(const InputArguments& input,
+            unsigned int flags,
+            bool packed = false) :
+      class_id_(mxCHAR_CLASS), flags_(flags), packed_(packed) {
+    string type = input.get<string>("KEYTYPE", "char");
+    if (type == "uint32")
+      class_id_ = mxUINT32_CLASS;
+    else if (type == "uint64")
+      class_id_ = mxUINT64_CLASS;
+    else if (type == "int64")
+      class_id_ = mxINT64_CLASS;
+    else if (type == "tuple")
+      class_id_ = mxCELL_CLASS;
+    else
+      ASSERT(type == "char", "Invalid KEYTYPE: %s.", type.c_str());
+    ASSERT(!packed_ || class_id_ == mxCHAR_CLASS, "PACKED requires char keys.");
+  }
+  virtual ~KeyFormat() {}
+  // Check if the keys are decoded into a cell array of char rows.
+  bool isChar() const { return class_id_ == mxCHAR_CLASS && !packed_; }
+  // Decode the key into a char row, an integer scalar, or a tuple.
+  mxArray* decode(const Record& key) const {
+    if (isChar())
+      return ValueFormat().decode(key);
+    else if (class_id_ == mxCELL_CLASS)
+      return TupleCodec::decode(key.begin(), key.end() - key.begin());
+    return decode(vector<Record>(1, key));
+  }
+  // Decode the keys into a cell array of char rows or tuples, or an integer
+  // row vector.
+  mxArray* decode(const vector<Record>& keys) const {
+    if (packed_)
+      return createPacked(keys);
+    if (isChar() || class_id_ == mxCELL_CLASS) {
+      vector<mxArray*> arrays(keys.size());
+      for (size_t i = 0; i < keys.size(); ++i)
+        arrays[i] = decode(keys[i]);
+      return createCell(arrays);
+    }
+    mxArray* array = mxCreateUninitNumericMatrix(1, keys.size(), class_id_,
+                                                 mxREAL);
+    MEXPLUS_CHECK_NOTNULL(array);
+    size_t size = mxGetElementSize(array);
+    char* data = static_cast<char*>(mxGetData(array));
+    for (size_t i = 0; i < keys.size(); ++i) {
+      size_t key_size = keys[i].end() - keys[i].begin();
+      ASSERT(key_size == size, "Key of %d bytes is not %s.",
+             static_cast<int>(key_size), mxGetClassName(array));
+      std::copy(keys[i].begin(), keys[i].end(), data + i * size);
+      convertIntegerKey(data + i * size, size, class_id_, flags_, false);
+    }
+    return array;
+  }
+
+private:
+  // Create a char matrix whose rows are the keys.
+  static mxArray* createPacked(const vector<Record>& keys) {
+    size_t width = 0;
+    for (size_t i = 0; i < keys.size(); ++i)
+      width = max(width, static_cast<size_t>(keys[i].end() - keys[i].begin()));
+    const mwSize dimensions[] = {keys.size(), width};
+    mxArray* array = mxCreateCharArray(2, dimensions);
+    MEXPLUS_CHECK_NOTNULL(array);
+    mxChar* chars = mxGetChars(array);
+    for (size_t i = 0; i < keys.size(); ++i) {
+      const unsigned char* key =
+          reinterpret_cast<const unsigned char*>(keys[i].begin());
+      size_t size = keys[i].end() - keys[i].begin();
+      for (size_t j = 0; j < width; ++j)
+        chars[j * keys.size() + i] = (j < size) ? key[j] : ' ';
+    }
+    return array;
+  }
+
+  // Class of the keys.
+  mxClassID class_id_;
+  // Flags of the table.
+  unsigned int flags_;
+  // Flag to decode char keys into a matrix.
+  bool packed_;
+};
+
+// Get a value record from mxArray, serializing it if requested.
+void getValue(const mxArray* array, bool serialize, Record* value) {
+  ASSERT(value, "Null pointer exception.");
+  if (serialize) {
+    string buffer;
+    Serializer::encode(array, &buffer);
+    value->swap(&buffer);
+  } else {
+    value->initialize(array);
+  }
+}
+
+// Get the table of the TABLE option, or NULL if not given.
+Database* getTable(const InputArguments& input) {
+  const mxArray* table = input.get("TABLE");
+  return (table) ? Session<Database>::get(table) : NULL;
+}
+
+// Get the flags of the table, or of the transaction if NULL.
+unsigned int getFlags(Transaction* transaction, Database* table) {
+  return (table) ? table->getFlags() : transaction->getFlags();
+}
+
+// Grow the map after MDB_MAP_FULL in a transaction of the user, who has to
+// run it again.
+void retryInGrownMap(Transaction* transaction) {
+  transaction->abortAndGrow();
+  ERROR("%s. The map has grown. Run the transaction again.",
+        mdb_strerror(MDB_MAP_FULL));
+}
+
+// Run the writes in a write transaction. When the map is full and can grow,
+// the transaction is aborted and the writes run again in the grown map.
+void writeRecords(Database* database,
+                  const function<bool(Transaction*)>& writes) {
+  while (true) {
+    Transaction transaction(database, NULL, 0);
+    if (writes(&transaction) && transaction.commit())
+      return;
+    transaction.abort();
+    database->grow();
+  }
+}
+
+// Caffe Datum message decoded from the protocol buffer wire format. The
+// image data references the record and is valid while the transaction is.
+class Datum {
+public:
+  // Create an empty datum.
+  Datum() : channels_(0), height_(0), width_(0), label_(0), encoded_(false),
+            data_(NULL), data_size_(0) {}
+  // Parse the wire format of the record, or return false if malformed. This
+  // is safe in any thread.
+  bool parse(const Record& record) {
+    const char* data = record.begin();
+    const char* end = record.end();
+    while (data < end) {
+      uint64_t tag;
+      if (!readVarint(&data, end, &tag))
+        return false;
+      int field = static_cast<int>(tag >> 3);
+      int wire_type = static_cast<int>(tag & 7);
+      if (wire_type == 0) {
+        uint64_t value;
+        if (!readVarint(&data, end, &value))
+          return false;
+        if (field == 1)
+          channels_ = static_cast<int>(value);
+        else if (field == 2)
+          height_ = static_cast<int>(value);
+        else if (field == 3)
+          width_ = static_cast<int>(value);
+        else if (field == 5)
+          label_ = static_cast<int32_t>(value);
+        else if (field == 7)
+          encoded_ = value != 0;
+      } else if (wire_type == 2) {
+        uint64_t size;
+        if (!readVarint(&data, end, &size) ||
+            size > static_cast<uint64_t>(end - data))
+          return false;
+        if (field == 4) {
+          data_ = data;
+          data_size_ = size;
+        } else if (field == 6) {
+          if (size % sizeof(float) != 0)
+            return false;
+          size_t offset = float_data_.size();
+          float_data_.resize(offset + size / sizeof(float));
+          if (size > 0)
+            memcpy(&float_data_[offset], data, size);
+        }
+        data += size;
+      } else if (wire_type == 5) {
+        if (end - data < 4)
+          return false;
+        if (field == 6) {
+          float value;
+          memcpy(&value, data, sizeof(value));
+          float_data_.push_back(value);
+        }
+        data += 4;
+      } else if (wire_type == 1 && end - data >= 8) {
+        data += 8;
+      } else {
+        return false;
+      }
+    }
+    return true;
+  }
+  // Number of channels.
+  int getChannels() const { return channels_; }
+  // Height of the image.
+  int getHeight() const { return height_; }
+  // Width of the image.
+  int getWidth() const { return width_; }
+  // Label.
+  int getLabel() const { return label_; }
+  // Flag to indicate the data is an encoded image file.
+  bool isEncoded() const { return encoded_; }
+  // Flag to indicate the image is stored in float_data.
+  bool isFloat() const { return data_size_ == 0 && !float_data_.empty(); }
+  // Get the byte data.
+  const char* getData() const { return data_; }
+  // Get the number of bytes of the data.
+  size_t getDataSize() const { return data_size_; }
+  // Get the float data.
+  const vector<float>& getFloatData() const { return float_data_; }
+
+private:
+  // Read a base 128 varint, or return false if malformed.
+  static bool readVarint(const char** data, const char* end, uint64_t* value) {
+    *value = 0;
+    for (int shift = 0; shift < 64 && *data < end; shift += 7) {
+      uint8_t byte = static_cast<uint8_t>(*(*data)++);
+      *value |= static_cast<uint64_t>(byte & 0x7F) << shift;
+      if (!(byte & 0x80))
+        return true;
+    }
+    return false;
+  }
+
+  // Number of channels.
+  int channels_;
+  // Height of the image.
+  int height_;
+  // Width of the image.
+  int width_;
+  // Label.
+  int label_;
+  // Flag to indicate the data is an encoded image file.
+  bool encoded_;
+  // Pointer to the byte data in the record.
+  const char* data_;
+  // Number of bytes of the data.
+  size_t data_size_;
+  // Float data.
+  vector<float> float_data_;
+};
+
+// Shape of a batch of datums.
+struct DatumShape {
+  DatumShape() : encoded(false), is_float(false), channels(0), height(0),
+                 width(0), size(0) {}
+  // Flag to indicate encoded image files.
+  bool encoded;
+  // Flag to indicate float_data.
+  bool is_float;
+  // Number of channels.
+  mwSize channels;
+  // Height of the images.
+  mwSize height;
+  // Width of the images.
+  mwSize width;
+  // Number of datums.
+  mwSize size;
+};
+
+// Get the shape of a batch of datums, or return an error message if datums
+// differ. This is safe in any thread.
+string getDatumShape(const vector<Datum>& datums, DatumShape* shape) {
+  *shape = DatumShape();
+  shape->size = datums.size();
+  if (datums.empty())
+    return string();
+  shape->encoded = datums[0].isEncoded();
+  shape->is_float = datums[0].isFloat();
+  shape->channels = datums[0].getChannels();
+  shape->height = datums[0].getHeight();
+  shape->width = datums[0].getWidth();
+  size_t image_size = shape->channels * shape->height * shape->width;
+  for (size_t i = 0; i < datums.size(); ++i) {
+    const Datum& datum = datums[i];
+    if (datum.isEncoded() != shape->encoded)
+      return "Datum batch mixes encoded images.";
+    if (shape->encoded)
+      continue;
+    if (datum.isFloat() != shape->is_float ||
+        static_cast<mwSize>(datum.getChannels()) != shape->channels ||
+        static_cast<mwSize>(datum.getHeight()) != shape->height ||
+        static_cast<mwSize>(datum.getWidth()) != shape->width)
+      return "Datum dimensions differ in the batch.";
+    if (((shape->is_float) ? datum.getFloatData().size() :
+                             datum.getDataSize()) != image_size)
+      return "Datum data does not match its dimensions.";
+  }
+  return string();
+}
+
+// Copy the images of datums to the H-by-W-by-C-by-N output. Caffe stores
+// images in C-by-H-by-W row-major order, which is transposed without changing
+// the channel order. This is safe in any thread.
+void copyDatumImages(const vector<Datum>& datums,
+                     const DatumShape& shape,
+                     void* output) {
+  size_t image_size = shape.channels * shape.height * shape.width;
+  for (size_t i = 0; i < datums.size(); ++i) {
+    if (shape.is_float) {
+      float* image = reinterpret_cast<float*>(output) + i * image_size;
+      const float* input = &datums[i].getFloatData()[0];
+      for (mwSize c = 0; c < shape.channels; ++c)
+        for (mwSize h = 0; h < shape.height; ++h)
+          for (mwSize w = 0; w < shape.width; ++w)
+            image[h + shape.height * (w + shape.width * c)] = *input++;
+    } else {
+      uint8_t* image = reinterpret_cast<uint8_t*>(output) + i * image_size;
+      const uint8_t* input = reinterpret_cast<const uint8_t*>(
+          datums[i].getData());
+      for (mwSize c = 0; c < shape.channels; ++c)
+        for (mwSize h = 0; h < shape.height; ++h)
+          for (mwSize w = 0; w < shape.width; ++w)
+            image[h + shape.height * (w + shape.width * c)] = *input++;
+    }
+  }
+}
+
+// Create an image array of the shape. Byte data becomes uint8 and
+// float_data becomes single.
+mxArray* createDatumImages(const DatumShape& shape) {
+  const mwSize dimensions[] = {shape.height, shape.width, shape.channels,
+                               shape.size};
+  mxArray* images = mxCreateUninitNumericArray(4, dimensions,
+      (shape.is_float) ? mxSINGLE_CLASS : mxUINT8_CLASS, mxREAL);
+  MEXPLUS_CHECK_NOTNULL(images);
+  return images;
+}
+
+// Create an H-by-W-by-C-by-N image array and an N-by-1 label array from
+// datums. Encoded image files are returned as a 1-by-N cell array of uint8
+// row vectors.
+void createDatumBatch(const vector<Datum>& datums,
+                      mxArray** images,
+                      mxArray** labels) {
+  DatumShape shape;
+  string error = getDatumShape(datums, &shape);
+  ASSERT(error.empty(), error.c_str());
+  MxArray label_array(mxCreateDoubleMatrix(shape.size, 1, mxREAL));
+  for (size_t i = 0; i < datums.size(); ++i)
+    label_array.set(i, datums[i].getLabel());
+  *labels = label_array.release();
+  if (shape.encoded) {
+    vector<mxArray*> files(datums.size());
+    for (size_t i = 0; i < datums.size(); ++i) {
+      files[i] = mxCreateNumericMatrix(1, datums[i].getDataSize(),
+                                       mxUINT8_CLASS, mxREAL);
+      MEXPLUS_CHECK_NOTNULL(files[i]);
+      if (datums[i].getDataSize() > 0)
+        memcpy(mxGetData(files[i]), datums[i].getData(),
+               datums[i].getDataSize());
+    }
+    *images = createCell(files);
+  } else {
+    *images = createDatumImages(shape);
+    copyDatumImages(datums, shape, mxGetData(*images));
+  }
+}
+
+// Read the arguments of a callback from the next record. When the chunk size
+// is positive, read up to the chunk size of records into cell arrays instead.
+bool readCallbackArguments(Cursor* cursor,
+                           size_t chunk_size,
+                           const ValueFormat& format,
+                           mxArray** keys,
+                           mxArray** values) {
+  if (chunk_size == 0) {
+    if (!cursor->get(MDB_NEXT))
+      return false;
+    *keys = MxArray::from(*cursor->getKey());
+    *values = format.decode(*cursor->getValue());
+    return true;
+  }
+  vector<mxArray*> key_arrays;
+  vector<mxArray*> value_arrays;
+  while (key_arrays.size() < chunk_size && cursor->get(MDB_NEXT)) {
+    key_arrays.push_back(MxArray::from(*cursor->getKey()));
+    value_arrays.push_back(format.decode(*cursor->getValue()));
+  }
+  if (key_arrays.empty())
+    return false;
+  *keys = createCell(key_arrays);
+  *values = createCell(value_arrays);
+  return true;
+}
+
+// Key range of a cursor scan. The range starts at START inclusive, ends at
+// END exclusive, and only contains keys beginning with PREFIX. PREFIX assumes
+// the default lexicographical key order.
+class Range {
+public:
+  // Create a range of the whole table.
+  Range() : has_start_(false), has_end_(false), has_prefix_(false),
+            limit_(0), reverse_(false), count_(0) {}
+  // Create a range from START, END, PREFIX, LIMIT, and REVERSE options in
+  // the key format of the table flags.
+  Range(const InputArguments& input, unsigned int flags) :
+      has_start_(input.get("START")),
+      has_end_(input.get("END")),
+      has_prefix_(input.get("PREFIX")),
+      limit_(input.get<size_t>("LIMIT", 0)),
+      reverse_(input.get<bool>("REVERSE", false)),
+      count_(0) {
+    // Empty START and PREFIX do not bound the range.
+    if (has_start_) {
+      getSingleKey(input.get("START"), flags, &start_);
+      has_start_ = start_.get()->mv_size > 0;
+    }
+    if (has_end_)
+      getSingleKey(input.get("END"), flags, &end_);
+    if (has_prefix_) {
+      getSingleKey(input.get("PREFIX"), flags, &prefix_);
+      has_prefix_ = prefix_.get()->mv_size > 0;
+      // The smallest key after all the keys beginning with the prefix.
+      string successor(prefix_.begin(), prefix_.end());
+      while (!successor.empty() &&
+             static_cast<unsigned char>(successor.back()) == 0xFF)
+        successor.pop_back();
+      if (!successor.empty()) {
+        ++successor.back();
+        prefix_end_.initialize(successor);
+      }
+    }
+  }
+  virtual ~Range() {}
+  // Move the cursor to the next record in the range.
+  bool next(Cursor* cursor) {
+    if (limit_ && count_ >= limit_)
+      return false;
+    bool found = (count_ == 0) ? seek(cursor, reverse_) :
+                 cursor->get((reverse_) ? MDB_PREV : MDB_NEXT);
+    if (!found || !contains(cursor, cursor->getKey()))
+      return false;
+    ++count_;
+    return true;
+  }
+  // Find the first and the last keys in the range, or return false if empty.
+  bool findBounds(Cursor* cursor, Record* first, Record* last) {
+    if (!seek(cursor, false) || !contains(cursor, cursor->getKey()))
+      return false;
+    first->initialize(string(cursor->getKey()->begin(),
+                             cursor->getKey()->end()));
+    if (!seek(cursor, true) || !contains(cursor, cursor->getKey()))
+      return false;
+    last->initialize(string(cursor->getKey()->begin(),
+                            cursor->getKey()->end()));
+    return true;
+  }
+  // Find the ordinals of the records in the range, from begin to end in the
+  // key order, by the ordinal index of the table in the transaction of the
+  // cursor.
+  void findOrdinals(Cursor* cursor,
+                    const OrdinalIndex& index,
+                    size_t* begin,
+                    size_t* end) {
+    Record* lower = getLower(cursor);
+    Record* upper = getUpper(cursor);
+    bool found = false;
+    *begin = (lower) ? index.rank(cursor->get(), *lower->get(), &found) : 0;
+    *end = (upper) ? index.rank(cursor->get(), *upper->get(), &found) :
+                     index.size();
+    if (*end < *begin)
+      *end = *begin;
+    if (limit_ && *end - *begin > limit_) {
+      if (reverse_)
+        *begin = *end - limit_;
+      else
+        *end = *begin + limit_;
+    }
+  }
+  // Check if the key is in the range. This is safe in any thread.
+  bool contains(Cursor* cursor, Record* key) {
+    if (has_prefix_ && (key->end() - key->begin() <
+                        prefix_.end() - prefix_.begin() ||
+        !equal(prefix_.begin(), prefix_.end(), key->begin())))
+      return false;
+    if (has_start_ && cursor->compare(key, &start_) < 0)
+      return false;
+    if (has_end_ && cursor->compare(key, &end_) >= 0)
+      return false;
+    return true;
+  }
+  // Flag to scan in the descending order.
+  bool isReverse() const { return reverse_; }
+  // Flag to indicate LIMIT is given.
+  bool hasLimit() const { return limit_ > 0; }
+  // Flag to indicate PREFIX is given.
+  bool hasPrefix() const { return has_prefix_; }
+
+private:
+  // Get the inclusive lower bound, or NULL if unbounded.
+  Record* getLower(Cursor* cursor) {
+    if (has_start_ && has_prefix_)
+      return (cursor->compare(&start_, &prefix_) > 0) ? &start_ : &prefix_;
+    return (has_start_) ? &start_ : (has_prefix_) ? &prefix_ : NULL;
+  }
+  // Get the exclusive upper bound, or NULL if unbounded.
+  Record* getUpper(Cursor* cursor) {
+    bool has_prefix_end = has_prefix_ && prefix_end_.get()->mv_size > 0;
+    if (has_end_ && has_prefix_end)
+      return (cursor->compare(&end_, &prefix_end_) < 0) ? &end_ : &prefix_end_;
+    return (has_end_) ? &end_ : (has_prefix_end) ? &prefix_end_ : NULL;
+  }
+  // Position the cursor at the first record in the range, or the last record
+  // if reverse.
+  bool seek(Cursor* cursor, bool reverse) {
+    Record* bound = (reverse) ? getUpper(cursor) : getLower(cursor);
+    if (!bound)
+      return cursor->get((reverse) ? MDB_LAST : MDB_FIRST);
+    if (bound->get()->mv_size == 0)
+      return false;
+    *cursor->getKey() = *bound;
+    if (!cursor->get(MDB_SET_RANGE))
+      return reverse && cursor->get(MDB_LAST);
+    return !reverse || cursor->get(MDB_PREV);
+  }
+
+  // Flag to indicate START is given.
+  bool has_start_;
+  // Flag to indicate END is given.
+  bool has_end_;
+  // Flag to indicate PREFIX is given.
+  bool has_prefix_;
+  // Inclusive lower bound.
+  Record start_;
+  // Exclusive upper bound.
+  Record end_;
+  // Key prefix.
+  Record prefix_;
+  // Exclusive upper bound of the prefix, or empty if unbounded.
+  Record prefix_end_;
+  // Maximum number of records, or 0 if unlimited.
+  size_t limit_;
+  // Flag to scan in the descending order.
+  bool reverse_;
+  // Number of records visited so far.
+  size_t count_;
+};
+
+// Get the bytes of the key in the order of the comparison function, which is
+// big-endian for integer keys and reversed for REVERSEKEY.
+string getOrderedBytes(const char* begin, const char* end,
+                       unsigned int flags) {
+  string bytes(begin, end);
+  if ((flags & MDB_REVERSEKEY) ||
+      ((flags & MDB_INTEGERKEY) && isLittleEndian()))
+    reverse(bytes.begin(), bytes.end());
+  return bytes;
+}
+
+// Get a key halfway between lower and upper by interpolating the bytes after
+// their common prefix, or return false if there is no such key.
+bool getMiddleKey(const Record& lower,
+                  const Record& upper,
+                  unsigned int flags,
+                  Record* middle) {
+  string lower_bytes = getOrderedBytes(lower.begin(), lower.end(), flags);
+  string upper_bytes = getOrderedBytes(upper.begin(), upper.end(), flags);
+  size_t prefix = 0;
+  while (prefix < lower_bytes.size() && prefix < upper_bytes.size() &&
+         lower_bytes[prefix] == upper_bytes[prefix])
+    ++prefix;
+  size_t width = min(sizeof(uint64_t),
+                     max(lower_bytes.size(), upper_bytes.size()) - prefix);
+  uint64_t lower_value = 0;
+  uint64_t upper_value = 0;
+  for (size_t i = prefix; i < prefix + width; ++i) {
+    lower_value = (lower_value << 8) | ((i < lower_bytes.size()) ?
+        static_cast<uint8_t>(lower_bytes[i]) : 0);
+    upper_value = (upper_value << 8) | ((i < upper_bytes.size()) ?
+        static_cast<uint8_t>(upper_bytes[i]) : 0);
+  }
+  if (upper_value <= lower_value + 1)
+    return false;
+  uint64_t value = lower_value + (upper_value - lower_value) / 2;
+  string bytes(upper_bytes, 0, prefix);
+  for (size_t i = width; i > 0; --i)
+    bytes.push_back(static_cast<char>((value >> (8 * (i - 1))) & 0xFF));
+  middle->initialize(getOrderedBytes(bytes.data(),
+                                     bytes.data() + bytes.size(),
+                                     flags));
+  return true;
+}
+
+// Sample existing keys that split the keys from first to last into at most
+// the count of subranges, and return the lower bounds of the subranges. Each
+// round bisects the key space between adjacent samples and moves the middle
+// to a nearby key, so that the samples follow the distribution of the keys.
+vector<Record> sampleKeyRange(Cursor* cursor,
+                              const Record& first,
+                              const Record& last,
+                              size_t count,
+                              unsigned int flags) {
+  vector<Record> samples(1, first);
+  samples.push_back(last);
+  bool updated = true;
+  while (updated && samples.size() <= count) {
+    updated = false;
+    vector<Record> next_samples(1, samples[0]);
+    for (size_t i = 1; i < samples.size(); ++i) {
+      Record middle;
+      if (next_samples.size() + samples.size() - i <= count &&
+          getMiddleKey(samples[i - 1], samples[i], flags, &middle)) {
+        Record* key = cursor->getKey();
+        *key = middle;
+        bool found = cursor->get(MDB_SET_RANGE);
+        if (found && cursor->compare(key, &samples[i]) >= 0)
+          found = cursor->get(MDB_PREV);
+        if (found && cursor->compare(key, &samples[i - 1]) > 0 &&
+            cursor->compare(key, &samples[i]) < 0) {
+          next_samples.push_back(Record(string(key->begin(), key->end())));
+          updated = true;
+        }
+      }
+      next_samples.push_back(samples[i]);
+    }
+    samples.swap(next_samples);
+  }
+  samples.pop_back();
+  return samples;
+}
+
+// Scan of a range by worker threads with read-only transactions on the same
+// snapshot. The range is split by sampled keys into more subranges than
+// workers, which take them in turn. Records stay in the memory
+// map while the scan exists, so that the MATLAB thread allocates mxArrays and
+// the workers copy the data in parallel.
+class ParallelScan {
+public:
+  // Create a scan with the number of workers.
+  ParallelScan(Database* database, size_t threads) :
+      database_(database), pool_(threads), txns_(threads, NULL) {}
+  // Abort the read-only transactions in their own threads.
+  virtual ~ParallelScan() { endTransactions(); }
+  // Scan the range, or return false if workers could not share a snapshot.
+  bool scan(Range* range) {
+    const int kMaxAttempts = 3;
+    const size_t kSubrangesPerWorker = 8;
+    for (int attempt = 0; attempt < kMaxAttempts; ++attempt) {
+      // All the transactions are on the same snapshot if no commit is made
+      // while they begin.
+      size_t id = database_->getLastTransactionID();
+      Transaction transaction;
+      transaction.renew(database_);
+      MDB_dbi dbi = database_->getDBI();
+      unsigned int flags = transaction.getFlags();
+      vector<int> statuses(pool_.size(), MDB_SUCCESS);
+      pool_.run([&](size_t index) {
+        statuses[index] = mdb_txn_begin(database_->getEnv(), NULL,
+                                        MDB_RDONLY, &txns_[index]);
+        if (statuses[index] != MDB_SUCCESS)
+          txns_[index] = NULL;
+      });
+      for (size_t i = 0; i < statuses.size(); ++i)
+        ASSERT(statuses[i] == MDB_SUCCESS, mdb_strerror(statuses[i]));
+      if (database_->getLastTransactionID() != id) {
+        endTransactions();
+        continue;
+      }
+      Record first;
+      Record last;
+      Cursor cursor;
+      cursor.open(transaction.get(), dbi);
+      if (range->findBounds(&cursor, &first, &last))
+        scanSubranges(range, sampleKeyRange(&cursor, first, last,
+                                            pool_.size() * kSubrangesPerWorker,
+                                            flags));
+      cursor.close();
+      transaction.commit();
+      return true;
+    }
+    return false;
+  }
+  // Get the keys in the order of the range.
+  const vector<MDB_val>& getKeys() const { return keys_; }
+  // Get the values in the order of the range.
+  const vector<MDB_val>& getValues() const { return values_; }
+  // Run the function over indices from 0 to size - 1 in the workers.
+  void parallelFor(size_t size, const function<void(size_t)>& body) {
+    pool_.parallelFor(size, body);
+  }
+
+private:
+  // Scan the subranges from the lower bounds in the workers, and concatenate
+  // the records.
+  void scanSubranges(Range* range, vector<Record> bounds) {
+    vector<vector<MDB_val> > keys(bounds.size());
+    vector<vector<MDB_val> > values(bounds.size());
+    vector<int> statuses(pool_.size(), MDB_SUCCESS);
+    atomic<size_t> next(0);
+    MDB_dbi dbi = database_->getDBI();
+    pool_.run([&](size_t index) {
+      MDB_cursor* raw_cursor = NULL;
+      statuses[index] = mdb_cursor_open(txns_[index], dbi, &raw_cursor);
+      if (statuses[index] != MDB_SUCCESS)
+        return;
+      Cursor cursor(raw_cursor);
+      for (size_t i = next++; i < bounds.size(); i = next++) {
+        Record key;
+        Record value;
+        *key.get() = *bounds[i].get();
+        int status = mdb_cursor_get(raw_cursor, key.get(), value.get(),
+                                    MDB_SET_RANGE);
+        while (status == MDB_SUCCESS) {
+          if ((i + 1 < bounds.size() &&
+               cursor.compare(&key, &bounds[i + 1]) >= 0) ||
+              !range->contains(&cursor, &key))
+            break;
+          keys[i].push_back(*key.get());
+          values[i].push_back(*value.get());
+          status = mdb_cursor_get(raw_cursor, key.get(), value.get(),
+                                  MDB_NEXT);
+        }
+        if (status != MDB_SUCCESS && status != MDB_NOTFOUND)
+          statuses[index] = status;
+      }
+    });
+    for (size_t i = 0; i < statuses.size(); ++i)
+      ASSERT(statuses[i] == MDB_SUCCESS, mdb_strerror(statuses[i]));
+    for (size_t i = 0; i < bounds.size(); ++i) {
+      keys_.insert(keys_.end(), keys[i].begin(), keys[i].end());
+      values_.insert(values_.end(), values[i].begin(), values[i].end());
+    }
+    if (range->isReverse()) {
+      reverse(keys_.begin(), keys_.end());
+      reverse(values_.begin(), values_.end());
+    }
+  }
+  // Abort the read-only transactions in the workers.
+  void endTransactions() {
+    pool_.run([this](size_t index) {
+      if (txns_[index])
+        mdb_txn_abort(txns_[index]);
+      txns_[index] = NULL;
+    });
+  }
+
+  // Database pointer.
+  Database* database_;
+  // Worker threads.
+  WorkerPool pool_;
+  // Read-only transactions of the workers.
+  vector<MDB_txn*> txns_;
+  // Keys in the order of the range.
+  vector<MDB_val> keys_;
+  // Values in the order of the range.
+  vector<MDB_val> values_;
+};
+
+// Scan the range into cell arrays of keys and values, or keys in the key
+// format. With more than one thread and no LIMIT, the range
+// is scanned in parallel.
+void scanRange(Database* database,
+               const InputArguments& input,
+               const KeyFormat& key_format,
+               mxArray** keys,
+               mxArray** values) {
+  Range range(input, database->getFlags());
+  ValueFormat char_format;
+  ValueFormat value_format = (values) ? ValueFormat(input) : ValueFormat();
+  size_t threads = input.get<size_t>("THREADS", 1);
+  vector<mxArray*> key_arrays;
+  vector<mxArray*> value_arrays;
+  if (threads > 1 && !range.hasLimit()) {
+    ParallelScan scan(database, threads);
+    if (scan.scan(&range)) {
+      const vector<MDB_val>& key_values = scan.getKeys();
+      const vector<MDB_val>& value_values = scan.getValues();
+      size_t size = key_values.size();
+      vector<Record> key_records(size);
+      vector<Record> value_records(size);
+      for (size_t i = 0; i < size; ++i) {
+        *key_records[i].get() = key_values[i];
+        *value_records[i].get() = value_values[i];
+        if (keys && key_format.isChar())
+          key_arrays.push_back(char_format.create(key_records[i]));
+        if (values)
+          value_arrays.push_back(value_format.create(value_records[i]));
+      }
+      scan.parallelFor(size, [&](size_t i) {
+        if (keys && key_format.isChar())
+          char_format.copy(key_records[i], key_arrays[i]);
+        if (values)
+          value_format.copy(value_records[i], value_arrays[i]);
+      });
+      if (keys)
+        *keys = (key_format.isChar()) ? createCell(key_arrays) :
+                                        key_format.decode(key_records);
+      if (values)
+        *values = createCell(value_arrays);
+      return;
+    }
+  }
+  Transaction transaction;
+  transaction.renew(database);
+  Cursor cursor;
+  cursor.open(transaction.get(), database->getDBI());
+  vector<Record> key_records;
+  while (range.next(&cursor)) {
+    if (keys)
+      key_records.push_back(*cursor.getKey());
+    if (values)
+      value_arrays.push_back(value_format.decode(*cursor.getValue()));
+  }
+  if (keys)
+    *keys = key_format.decode(key_records);
+  cursor.close();
+  transaction.commit();
+  if (values)
+    *values = createCell(value_arrays);
+}
+
+// Get the ordinal index of the table in the read-only transaction on the
+// snapshot of the ID. The index is kept with the table and built again when
+// the snapshot changed, except that the index of a table opened with ORDINAL
+// follows the writes through the table, and is built again only when a commit
+// from elsewhere changed the statistics of the table.
+shared_ptr<OrdinalIndex> getOrdinalIndex(Database* database,
+                                         MDB_txn* txn,
+                                         size_t id) {
+  shared_ptr<OrdinalIndex> index = database->getOrdinalIndex();
+  if (index->getGeneration() == 0 || index->getID() != id) {
+    MDB_stat stat;
+    int status = mdb_stat(txn, database->getDBI(), &stat);
+    ASSERT(status == MDB_SUCCESS, mdb_strerror(status));
+    if (database->isOrdinal() && index->matches(stat))
+      index->setID(id);
+    else
+      index->build(txn, database->getDBI(), id);
+  }
+  index->split(txn, database->getDBI());
+  return index;
+}
+
+// Get the ordinal index of the table, and renew the transaction on the
+// snapshot of the index.
+shared_ptr<OrdinalIndex> getOrdinalIndex(Database* database,
+                                         Transaction* transaction) {
+  size_t id = 0;
+  do {
+    id = database->getLastTransactionID();
+    transaction->renew(database);
+  } while (database->getLastTransactionID() != id);
+  return getOrdinalIndex(database, transaction->get(), id);
+}
+
+// Get the Bloom filter of the table, or NULL if the table has none. The
+// filter follows the commits of this process, and is built again from the
+// keys after a commit from another process, or when it holds too many keys.
+BloomFilter* getBloomFilter(Database* database) {
+  BloomFilter* filter = database->getBloomFilter();
+  if (!filter)
+    return filter;
+  size_t last_id = database->getLastTransactionID();
+  while (filter->getID() < last_id &&
+         database->isOwnCommit(filter->getID() + 1))
+    filter->setID(filter->getID() + 1);
+  if (filter->getID() == last_id && !filter->isFull())
+    return filter;
+  // Keys queued before the scan may be committed after it.
+  vector<string> queued_keys;
+  database->getQueuedKeys(&queued_keys);
+  Transaction transaction;
+  size_t id = 0;
+  do {
+    id = database->getLastTransactionID();
+    transaction.renew(database);
+  } while (database->getLastTransactionID() != id);
+  MDB_stat stat;
+  int status = mdb_stat(transaction.get(), database->getDBI(), &stat);
+  ASSERT(status == MDB_SUCCESS, mdb_strerror(status));
+  filter->reset(stat.ms_entries + queued_keys.size());
+  Cursor cursor;
+  cursor.open(transaction.get(), database->getDBI());
+  bool found = cursor.get(MDB_FIRST);
+  while (found) {
+    filter->add(*cursor.getKey());
+    found = cursor.get(MDB_NEXT_NODUP);
+  }
+  cursor.close();
+  transaction.commit();
+  for (size_t i = 0; i < queued_keys.size(); ++i)
+    filter->add(Record(queued_keys[i]));
+  filter->setID(id);
+  return filter;
+}
+
+// List of all the keys of a table in a single buffer. It is tagged with the
+// transaction ID and the number of entries of the snapshot, and is saved to
+// and loaded from a file to skip listing the keys of an unchanged table. The
+// file is in the native byte order.
+class KeyCache {
+public:
+  // Create an empty list.
+  KeyCache() : id_(0), entries_(0) {}
+  virtual ~KeyCache() {}
+  // List the keys in the transaction of the cursor.
+  void build(Cursor* cursor, size_t id, size_t entries) {
+    id_ = id;
+    entries_ = entries;
+    key_buffer_.clear();
+    key_offsets_.assign(1, 0);
+    bool found = cursor->get(MDB_FIRST);
+    while (found) {
+      key_buffer_.append(cursor->getKey()->begin(), cursor->getKey()->end());
+      key_offsets_.push_back(key_buffer_.size());
+      found = cursor->get(MDB_NEXT);
+    }
+  }
+  // Load the file, or return false if it is missing or of another snapshot.
+  bool load(const string& filename, size_t id, size_t entries) {
+    FILE* file = fopen(filename.c_str(), "rb");
+    if (!file)
+      return false;
+    uint64_t header[4] = {0, 0, 0, 0};
+    bool loaded = fread(header, sizeof(header), 1, file) == 1 &&
+                  header[0] == kMagic && header[1] == id &&
+                  header[2] == entries;
+    if (loaded) {
+      vector<uint64_t> offsets(header[3] + 1);
+      loaded = fread(&offsets[0], sizeof(uint64_t), offsets.size(), file) ==
+               offsets.size();
+      if (loaded) {
+        key_offsets_.assign(offsets.begin(), offsets.end());
+        key_buffer_.resize(offsets.back());
+        loaded = offsets.back() == 0 ||
+                 fread(&key_buffer_[0], offsets.back(), 1, file) == 1;
+      }
+    }
+    fclose(file);
+    id_ = id;
+    entries_ = entries;
+    if (loaded)
+      filename_ = filename;
+    return loaded;
+  }
+  // Save the file. A failure is ignored, as the file is only a cache.
+  void save(const string& filename) {
+    FILE* file = fopen(filename.c_str(), "wb");
+    if (!file)
+      return;
+    const uint64_t header[4] = {kMagic, id_, entries_, size()};
+    vector<uint64_t> offsets(key_offsets_.begin(), key_offsets_.end());
+    bool saved = fwrite(header, sizeof(header), 1, file) == 1 &&
+                 fwrite(&offsets[0], sizeof(uint64_t), offsets.size(),
+                        file) == offsets.size() &&
+                 (key_buffer_.empty() ||
+                  fwrite(key_buffer_.data(), key_buffer_.size(), 1,
+                         file) == 1);
+    if (fclose(file) != 0 || !saved)
+      remove(filename.c_str());
+    else
+      filename_ = filename;
+  }
+  // Get the file loaded or saved last, or empty if none.
+  const string& getFilename() const { return filename_; }
+  // Get the number of keys.
+  size_t size() const { return key_offsets_.size() - 1; }
+  // Get the transaction ID of the snapshot.
+  size_t getID() const { return id_; }
+  // Get the number of entries of the snapshot.
+  size_t getEntries() const { return entries_; }
+  // Get the keys as records referring to the buffer.
+  vector<Record> getKeys() const {
+    vector<Record> keys(size());
+    for (size_t i = 0; i < keys.size(); ++i) {
+      keys[i].get()->mv_data =
+          const_cast<char*>(key_buffer_.data()) + key_offsets_[i];
+      keys[i].get()->mv_size = key_offsets_[i + 1] - key_offsets_[i];
+    }
+    return keys;
+  }
+
+private:
+  // Magic number at the beginning of the file.
+  static const uint64_t kMagic = 0x315359454B424D4Cull;
+
+  // Transaction ID of the snapshot.
+  size_t id_;
+  // Number of entries of the snapshot.
+  size_t entries_;
+  // Keys in a single buffer.
+  string key_buffer_;
+  // Offsets of the keys in the buffer.
+  vector<size_t> key_offsets_;
+  // File of the same snapshot.
+  string filename_;
+};
+
+// Get the keys of the whole table, which are listed again after a commit to
+// the environment. With a filename, the keys are loaded from the file if it
+// is of the same snapshot, or otherwise saved to the file.
+shared_ptr<KeyCache> getKeyCache(Database* database,
+                                 const string& filename) {
+  Transaction transaction;
+  size_t id = 0;
+  do {
+    id = database->getLastTransactionID();
+    transaction.renew(database);
+  } while (database->getLastTransactionID() != id);
+  MDB_stat stat;
+  int status = mdb_stat(transaction.get(), database->getDBI(), &stat);
+  ASSERT(status == MDB_SUCCESS, mdb_strerror(status));
+  shared_ptr<KeyCache> cache = database->getKeyCache();
+  if (!cache || cache->getID() != id ||
+      cache->getEntries() != stat.ms_entries) {
+    cache.reset(new KeyCache);
+    if (filename.empty() || !cache->load(filename, id, stat.ms_entries)) {
+      Cursor cursor;
+      cursor.open(transaction.get(), database->getDBI());
+      cache->build(&cursor, id, stat.ms_entries);
+      cursor.close();
+    }
+    database->setKeyCache(cache);
+  }
+  transaction.commit();
+  if (!filename.empty() && cache->getFilename() != filename)
+    cache->save(filename);
+  return cache;
+}
+
+// Pseudo-random permutation of [0, size) to visit ordinals in a shuffled
+// order without a table of the size. It is a Feistel network on the smallest
+// domain of an even number of bits, and applies again until the result is in
+// the range.
+class Permutation {
+public:
+  // Create a permutation of the seed.
+  Permutation(size_t size, uint64_t seed) : size_(size), half_bits_(1) {
+    while (half_bits_ < 32 && (uint64_t(1) << (2 * half_bits_)) < size)
+      ++half_bits_;
+    mt19937_64 generator(seed);
+    for (int i = 0; i < kRounds; ++i)
+      keys_[i] = generator();
+  }
+  virtual ~Permutation() {}
+  // Get the index-th element of the permutation.
+  size_t operator()(size_t index) const {
+    uint64_t value = index;
+    do {
+      value = encrypt(value);
+    } while (value >= size_);
+    return value;
+  }
+
+private:
+  // Number of the rounds of the Feistel network.
+  static const int kRounds = 4;
+
+  // Apply the Feistel network to the value in the domain.
+  uint64_t encrypt(uint64_t value) const {
+    uint64_t mask = (half_bits_ < 32) ? (uint64_t(1) << half_bits_) - 1 :
+                                        0xFFFFFFFFull;
+    uint64_t left = value >> half_bits_;
+    uint64_t right = value & mask;
+    for (int i = 0; i < kRounds; ++i) {
+      uint64_t next = left ^ (mix(right ^ keys_[i]) & mask);
+      left = right;
+      right = next;
+    }
+    return (left << half_bits_) | right;
+  }
+  // Round function by the finalizer of splitmix64.
+  static uint64_t mix(uint64_t value) {
+    value = (value ^ (value >> 30)) * 0xBF58476D1CE4E5B9ull;
+    value = (value ^ (value >> 27)) * 0x94D049BB133111EBull;
+    return value ^ (value >> 31);
+  }
+
+  // Number of the elements.
+  size_t size_;
+  // Number of bits of a half of the domain.
+  int half_bits_;
+  // Round keys.
+  uint64_t keys_[kRounds];
+};
+
+// Minibatch iterator that reads and decodes the next batches ahead in worker
+// threads. Records in the range are found by a copy of the ordinal index of
+// the table on the snapshot of the workers, and each epoch visits them in the
+// key order or in the shuffled order of a Permutation, without a list of all
+// the keys.
+class DataLoader {
+public:
+  // Create a loader from the range options.
+  DataLoader(Database* database, const InputArguments& input) :
+      database_(database),
+      batch_size_(input.get<size_t>("BATCHSIZE", 256)),
+      shuffle_(input.get<bool>("SHUFFLE", false)),
+      datum_(input.get<bool>("DATUM", false)),
+      seed_(input.get<double>("SEED", random_device()())),
+      format_(input),
+      begin_(0),
+      end_(0),
+      reverse_(false),
+      slots_(input.get<size_t>("PREFETCH", 4)),
+      next_batch_(0),
+      consumed_(0),
+      started_(0),
+      pinned_(false),
+      stopped_(false) {
+    ASSERT(batch_size_ > 0, "BATCHSIZE must be positive.");
+    ASSERT(!slots_.empty(), "PREFETCH must be positive.");
+    size_t threads = input.get<size_t>("THREADS", 2);
+    ASSERT(threads > 0, "THREADS must be positive.");
+    Range range(input, database_->getFlags());
+    // Begin the transactions of the workers and of the index on the same
+    // snapshot, and begin again if a commit came in between.
+    Transaction transaction;
+    size_t id = 0;
+    while (true) {
+      id = database_->getLastTransactionID();
+      for (size_t i = 0; i < threads; ++i)
+        threads_.push_back(thread(&DataLoader::work, this));
+      transaction.renew(database_);
+      {
+        unique_lock<mutex> lock(mutex_);
+        readable_.wait(lock, [&] { return started_ == threads_.size(); });
+      }
+      if (failure_.empty() && database_->getLastTransactionID() == id)
+        break;
+      stop();
+      ASSERT(failure_.empty(), failure_.c_str());
+      threads_.clear();
+      started_ = 0;
+      stopped_ = false;
+    }
+    // Stop the workers if the index fails.
+    unique_ptr<DataLoader, void (*)(DataLoader*)> stopper(
+        this, [](DataLoader* loader) { loader->stop(); });
+    index_ = *getOrdinalIndex(database_, transaction.get(), id);
+    Cursor cursor;
+    cursor.open(transaction.get(), database_->getDBI());
+    range.findOrdinals(&cursor, index_, &begin_, &end_);
+    reverse_ = range.isReverse();
+    cursor.close();
+    transaction.commit();
+    stopper.release();
+    batches_per_epoch_ = max<size_t>(1, (getSize() + batch_size_ - 1) /
+                                            batch_size_);
+    {
+      lock_guard<mutex> lock(mutex_);
+      pinned_ = true;
+    }
+    writable_.notify_all();
+    // Worker transactions keep the map in use.
+    database_->addTransaction();
+  }
+  // Stop the worker threads.
+  virtual ~DataLoader() {
+    stop();
+    database_->endTransaction();
+  }
+  // Get the number of records in an epoch.
+  size_t getSize() const { return end_ - begin_; }
+  // Wait for the next batch, and output the values and the keys, or the
+  // images, the labels, and the keys of datums, followed by a flag of the
+  // last batch of an epoch.
+  void next(OutputArguments* output) {
+    Batch* batch = &slots_[consumed_ % slots_.size()];
+    {
+      unique_lock<mutex> lock(mutex_);
+      readable_.wait(lock, [&] {
+        return !failure_.empty() || (batch->ready &&
+                                     batch->index == consumed_);
+      });
+      ASSERT(failure_.empty(), failure_.c_str());
+    }
+    string error = batch->error;
+    bool done = (batch->index % batches_per_epoch_ == batches_per_epoch_ - 1);
+    if (error.empty()) {
+      if (datum_) {
+        output->set(0, createImages(*batch));
+        output->set(1, createLabels(*batch));
+        output->set(2, createKeys(*batch));
+        output->set(3, done);
+      } else {
+        output->set(0, createValues(*batch));
+        output->set(1, createKeys(*batch));
+        output->set(2, done);
+      }
+    }
+    {
+      lock_guard<mutex> lock(mutex_);
+      batch->ready = false;
+      ++consumed_;
+    }
+    writable_.notify_all();
+    ASSERT(error.empty(), error.c_str());
+  }
+
+private:
+  // Batch buffer filled by a worker.
+  struct Batch {
+    Batch() : index(0), ready(false) {}
+    // Index of the batch from the first epoch.
+    size_t index;
+    // Flag to indicate the batch is filled.
+    bool ready;
+    // Error message of the worker.
+    string error;
+    // Keys in a single buffer.
+    string keys;
+    // Offsets of the keys in the buffer.
+    vector<size_t> key_offsets;
+    // Values, or the encoded image files of datums, in a single buffer.
+    string values;
+    // Offsets of the values in the buffer.
+    vector<size_t> value_offsets;
+    // Shape of the datum images.
+    DatumShape shape;
+    // Datum images in the H-by-W-by-C-by-N order.
+    vector<char> images;
+    // Datum labels.
+    vector<double> labels;
+  };
+
+  // Stop and join the worker threads.
+  void stop() {
+    {
+      lock_guard<mutex> lock(mutex_);
+      stopped_ = true;
+    }
+    writable_.notify_all();
+    for (size_t i = 0; i < threads_.size(); ++i)
+      threads_[i].join();
+  }
+  // Loop of a worker thread with its read-only transaction, which stays on
+  // the snapshot of the index for the lifetime of the loader.
+  void work() {
+    MDB_txn* txn = NULL;
+    int status = mdb_txn_begin(database_->getEnv(), NULL, MDB_RDONLY, &txn);
+    {
+      lock_guard<mutex> lock(mutex_);
+      if (status != MDB_SUCCESS)
+        failure_ = mdb_strerror(status);
+      ++started_;
+    }
+    readable_.notify_all();
+    if (status != MDB_SUCCESS)
+      return;
+    while (true) {
+      size_t index;
+      {
+        unique_lock<mutex> lock(mutex_);
+        writable_.wait(lock, [this] {
+          return stopped_ ||
+                 (pinned_ && next_batch_ < consumed_ + slots_.size());
+        });
+        if (stopped_)
+          break;
+        index = next_batch_++;
+        slots_[index % slots_.size()].index = index;
+      }
+      Batch* batch = &slots_[index % slots_.size()];
+      batch->error = fill(txn, index, batch);
+      {
+        lock_guard<mutex> lock(mutex_);
+        batch->ready = true;
+      }
+      readable_.notify_all();
+    }
+    mdb_txn_abort(txn);
+  }
+  // Read and decode the batch, or return an error message.
+  string fill(MDB_txn* txn, size_t index, Batch* batch) {
+    size_t epoch = index / batches_per_epoch_;
+    size_t begin = (index % batches_per_epoch_) * batch_size_;
+    size_t end = min(begin + batch_size_, getSize());
+    Permutation order(getSize(), seed_ + epoch);
+    batch->keys.clear();
+    batch->key_offsets.assign(1, 0);
+    batch->values.clear();
+    batch->value_offsets.assign(1, 0);
+    batch->labels.clear();
+    vector<Datum> datums;
+    MDB_cursor* cursor = NULL;
+    int status = mdb_cursor_open(txn, database_->getDBI(), &cursor);
+    if (status != MDB_SUCCESS)
+      return mdb_strerror(status);
+    unique_ptr<MDB_cursor, void (*)(MDB_cursor*)> cursor_closer(
+        cursor, mdb_cursor_close);
+    size_t position = index_.size();
+    for (size_t i = begin; i < end; ++i) {
+      MDB_val key;
+      Record value;
+      size_t ordinal = (shuffle_) ? order(i) : i;
+      ordinal = (reverse_) ? end_ - 1 - ordinal : begin_ + ordinal;
+      status = index_.seek(cursor, ordinal, &position, &key, value.get());
+      if (status != MDB_SUCCESS)
+        return mdb_strerror(status);
+      batch->keys.append(static_cast<const char*>(key.mv_data),
+                         key.mv_size);
+      batch->key_offsets.push_back(batch->keys.size());
+      if (datum_) {
+        datums.push_back(Datum());
+        if (!datums.back().parse(value))
+          return "Invalid Datum record.";
+        batch->labels.push_back(datums.back().getLabel());
+      } else {
+        batch->values.append(value.begin(), value.end());
+        batch->value_offsets.push_back(batch->values.size());
+      }
+    }
+    if (datum_) {
+      string error = getDatumShape(datums, &batch->shape);
+      if (!error.empty())
+        return error;
+      if (batch->shape.encoded) {
+        for (size_t i = 0; i < datums.size(); ++i) {
+          batch->values.append(datums[i].getData(),
+                               datums[i].getData() + datums[i].getDataSize());
+          batch->value_offsets.push_back(batch->values.size());
+        }
+      } else {
+        batch->images.resize(batch->shape.channels * batch->shape.height *
+                             batch->shape.width * batch->shape.size *
+                             ((batch->shape.is_float) ? sizeof(float) : 1));
+        if (!batch->images.empty())
+          copyDatumImages(datums, batch->shape, &batch->images[0]);
+      }
+    }
+    return string();
   }
-  // Apply the cursor operation and get the value.
-  bool get(MDB_cursor_op operation) {
-    int status = mdb_cursor_get(cursor_, key_.get(), value_.get(), operation);
-    ASSERT(status == MDB_SUCCESS || status == MDB_NOTFOUND,
-           mdb_strerror(status));
-    return status == MDB_SUCCESS;
+  // Get the index-th value of the batch.
+  Record getValue(const Batch& batch, size_t index) const {
+    Record value;
+    value.get()->mv_data = const_cast<char*>(batch.values.data()) +
+                           batch.value_offsets[index];
+    value.get()->mv_size = batch.value_offsets[index + 1] -
+                           batch.value_offsets[index];
+    return value;
   }
-  // Put the current key and value.
-  void put(unsigned int flags) {
-    int status = mdb_cursor_put(cursor_, key_.get(), value_.get(), flags);
-    ASSERT(status == MDB_SUCCESS, mdb_strerror(status));
+  // Create a cell array of the keys.
+  mxArray* createKeys(const Batch& batch) const {
+    vector<mxArray*> keys(batch.key_offsets.size() - 1);
+    for (size_t i = 0; i < keys.size(); ++i)
+      keys[i] = MxArray::from(string(
+          batch.keys.begin() + batch.key_offsets[i],
+          batch.keys.begin() + batch.key_offsets[i + 1]));
+    return createCell(keys);
   }
-  // Delete the current key and value.
-  void remove(unsigned int flags) {
-    int status = mdb_cursor_del(cursor_, flags);
-    ASSERT(status == MDB_SUCCESS, mdb_strerror(status));
+  // Create a cell array of the values.
+  mxArray* createValues(const Batch& batch) const {
+    vector<mxArray*> values(batch.key_offsets.size() - 1);
+    for (size_t i = 0; i < values.size(); ++i)
+      values[i] = format_.decode(getValue(batch, i));
+    return createCell(values);
+  }
+  // Create an image array, or a cell array of encoded image files.
+  mxArray* createImages(const Batch& batch) const {
+    if (batch.shape.encoded) {
+      vector<mxArray*> files(batch.key_offsets.size() - 1);
+      for (size_t i = 0; i < files.size(); ++i) {
+        Record file = getValue(batch, i);
+        files[i] = mxCreateNumericMatrix(1, file.end() - file.begin(),
+                                         mxUINT8_CLASS, mxREAL);
+        MEXPLUS_CHECK_NOTNULL(files[i]);
+        if (file.end() > file.begin())
+          memcpy(mxGetData(files[i]), file.begin(), file.end() - file.begin());
+      }
+      return createCell(files);
+    }
+    mxArray* images = createDatumImages(batch.shape);
+    if (!batch.images.empty())
+      memcpy(mxGetData(images), &batch.images[0], batch.images.size());
+    return images;
+  }
+  // Create an N-by-1 label array.
+  mxArray* createLabels(const Batch& batch) const {
+    MxArray labels(mxCreateDoubleMatrix(batch.labels.size(), 1, mxREAL));
+    for (size_t i = 0; i < batch.labels.size(); ++i)
+      labels.set(i, batch.labels[i]);
+    return labels.release();
   }
-  // Get the raw cursor.
-  MDB_cursor* get() { return cursor_; }
-  // Get the raw record.
-  Record* getKey() { return &key_; }
-  // Get the raw record.
-  Record* getValue() { return &value_; }
 
-private:
-  // MDB_cursor pointer.
-  MDB_cursor* cursor_;
-  // Key.
-  Record key_;
-  // Value.
-  Record value_;
+  // Database pointer.
+  Database* database_;
+  // Number of records in a batch.
+  size_t batch_size_;
+  // Flag to shuffle the order in each epoch.
+  bool shuffle_;
+  // Flag to decode Caffe Datum records.
+  bool datum_;
+  // Seed of the shuffled orders.
+  uint64_t seed_;
+  // Format of the values.
+  ValueFormat format_;
+  // Ordinal index of the table on the snapshot of the workers.
+  OrdinalIndex index_;
+  // Ordinal of the first record in the range.
+  size_t begin_;
+  // Ordinal after the last record in the range.
+  size_t end_;
+  // Flag to visit the range in the descending order.
+  bool reverse_;
+  // Number of batches in an epoch, or 1 for an empty range.
+  size_t batches_per_epoch_;
+  // Ring of the batches ahead.
+  vector<Batch> slots_;
+  // Index of the batch to fill next.
+  size_t next_batch_;
+  // Index of the batch to output next.
+  size_t consumed_;
+  // Number of the workers that began their transactions.
+  size_t started_;
+  // Flag to indicate the index is built on the snapshot of the workers.
+  bool pinned_;
+  // Flag to stop the workers.
+  bool stopped_;
+  // Error message of a worker that failed to start.
+  string failure_;
+  // Worker threads.
+  vector<thread> threads_;
+  // Mutex for the ring.
+  mutex mutex_;
+  // Condition of a free slot.
+  condition_variable writable_;
+  // Condition of a filled slot.
+  condition_variable readable_;
 };
 
-// Create a directory.
-void createDirectoryIfNotExist(const mxArray* filename) {
-  MxArray flag("dir");
-  mxArray* prhs[] = {const_cast<mxArray*>(filename),
-                     const_cast<mxArray*>(flag.get())};
-  mxArray* plhs;
-  ASSERT(mexCallMATLAB(1, &plhs, 2, prhs, "exist") == 0,
-         "Failed to check a directory.");
-  MxArray status(plhs);
-  if (!status.to<bool>())
-    ASSERT(mexCallMATLAB(0, NULL, 1, prhs, "mkdir") == 0,
-           "Failed to create a directory.");
-}
-
 } // namespace
 
 namespace mexplus {
 
-// Template specialization of mxArray* to Record.
-template <>
-void MxArray::to(const mxArray* array, Record* value) {
-  ASSERT(value, "Null pointer exception.");
-  value->initialize(MxArray(array).to<string>());
-}
-
-// Template specialization of Record to mxArray*.
-template <>
-mxArray* MxArray::from(const Record& value) {
-  return MxArray(string(value.begin(), value.end())).release();
-}
-
-// Template specialization of MDB_stat to mxArray*.
-template <>
-mxArray* MxArray::from(const MDB_stat& stat) {
-  MxArray value(Struct());
-  value.set("psize", stat.ms_psize);
-  value.set("depth", stat.ms_depth);
-  value.set("branch_pages", stat.ms_branch_pages);
-  value.set("leaf_pages", stat.ms_leaf_pages);
-  value.set("overflow_pages", stat.ms_overflow_pages);
-  value.set("entries", stat.ms_entries);
-  return value.release();
-}
-
 // Session instance storage.
-template class Session<Database>;
-template class Session<Transaction>;
-template class Session<Cursor>;
+template class Session<DataLoader>;
 
 } // namespace mexplus
 
 namespace {
 
-MEX_DEFINE(new) (int nlhs, mxArray* plhs[],
-                 int nrhs, const mxArray* prhs[]) {
-  InputArguments input(nrhs, prhs, 1, 23, "MODE", "FIXEDMAP", "NOSUBDIR",
-      "NOSYNC", "RDONLY", "NOMETASYNC", "WRITEMAP", "MAPASYNC", "NOTLS",
-      "NOLOCK", "NORDAHEAD", "NOMEMINIT", "REVERSEKEY", "DUPSORT",
-      "INTEGERKEY", "DUPFIXED", "INTEGERDUP", "REVERSEDUP", "CREATE",
-      "MAPSIZE", "MAXREADERS", "MAXDBS", "NAME");
-  OutputArguments output(nlhs, plhs, 1);
-  unique_ptr<Database> database(new Database);
-  ASSERT(database.get() != NULL, "Null pointer exception.");
-  database->setMapsize(input.get<size_t>("MAPSIZE", 10485760));
-  database->setMaxReaders(input.get<unsigned int>("MAXREADERS", 126));
-  database->setMaxDBS(input.get<MDB_dbi>("MAXDBS", 0));
+// Open the environment with the options, and return if it is read-only.
+bool openEnvironment(const InputArguments& input,
+                     MDB_dbi max_dbs,
+                     Environment* environment) {
+  environment->setMapsize(input.get<size_t>("MAPSIZE", 10485760));
+  environment->setMaxReaders(input.get<unsigned int>("MAXREADERS", 126));
+  environment->setMaxDBS(input.get<MDB_dbi>("MAXDBS", max_dbs));
   bool read_only = input.get<bool>("RDONLY", false);
   string filename(input.get<string>(0));
   mdb_mode_t mode = input.get<mdb_mode_t>("MODE", 0664);
@@ -321,20 +3745,93 @@ MEX_DEFINE(new) (int nlhs, mxArray* plhs[],
                        OPTIONFLAG(NOMEMINIT, false);
   if (!read_only)
     createDirectoryIfNotExist(input.get(0));
-  database->openEnv(filename.c_str(), flags, mode);
-  flags = OPTIONFLAG(REVERSEKEY, false) |
-          OPTIONFLAG(DUPSORT, false) |
-          OPTIONFLAG(INTEGERKEY, false) |
-          OPTIONFLAG(DUPFIXED, false) |
-          OPTIONFLAG(INTEGERDUP, false) |
-          OPTIONFLAG(REVERSEDUP, false) |
-          OPTIONFLAG(CREATE, !read_only);
+  environment->openEnv(filename.c_str(), flags, mode);
+  environment->setGrowthFactor(input.get<double>("GROWTHPOLICY", 0));
+  if (input.get<bool>("ASYNC", false)) {
+    ASSERT(!read_only, "ASYNC requires a writable database.");
+    environment->startWriter(input.get<size_t>("QUEUESIZE", 100000),
+                             input.get<size_t>("COMMITSIZE", 1000),
+                             input.get<double>("COMMITINTERVAL", 0.1));
+  }
+  return read_only;
+}
+
+// Open the named table with the options, or the unnamed one if empty.
+void openTable(const InputArguments& input,
+               const string& name,
+               bool read_only,
+               Database* database) {
+  unsigned int flags = OPTIONFLAG(REVERSEKEY, false) |
+                       OPTIONFLAG(DUPSORT, false) |
+                       OPTIONFLAG(INTEGERKEY, false) |
+                       OPTIONFLAG(DUPFIXED, false) |
+                       OPTIONFLAG(INTEGERDUP, false) |
+                       OPTIONFLAG(REVERSEDUP, false) |
+                       OPTIONFLAG(CREATE, !read_only);
+  Transaction transaction(database, NULL, (read_only) ? MDB_RDONLY : 0);
+  transaction.openDatabase(name, flags);
+  ASSERT(transaction.commit(), mdb_strerror(MDB_MAP_FULL));
+  database->setValueCache(input.get<size_t>("CACHESIZE", 0));
+  database->setBloomFilter(input.get<double>("BLOOMBITS", 0));
+  getBloomFilter(database);
+  database->setOrdinal(input.get<bool>("ORDINAL", false));
+}
+
+MEX_DEFINE(new) (int nlhs, mxArray* plhs[],
+                 int nrhs, const mxArray* prhs[]) {
+  InputArguments input(nrhs, prhs, 1, 31, "MODE", "FIXEDMAP", "NOSUBDIR",
+      "NOSYNC", "RDONLY", "NOMETASYNC", "WRITEMAP", "MAPASYNC", "NOTLS",
+      "NOLOCK", "NORDAHEAD", "NOMEMINIT", "REVERSEKEY", "DUPSORT",
+      "INTEGERKEY", "DUPFIXED", "INTEGERDUP", "REVERSEDUP", "CREATE",
+      "MAPSIZE", "MAXREADERS", "MAXDBS", "NAME", "ASYNC", "QUEUESIZE",
+      "COMMITSIZE", "COMMITINTERVAL", "GROWTHPOLICY", "CACHESIZE",
+      "BLOOMBITS", "ORDINAL");
+  OutputArguments output(nlhs, plhs, 1);
+  unique_ptr<Database> database(new Database);
+  ASSERT(database.get() != NULL, "Null pointer exception.");
+  bool read_only = openEnvironment(input, 0,
+                                   database->getEnvironment().get());
+  openTable(input, input.get<string>("NAME", ""), read_only, database.get());
+  output.set(0, Session<Database>::create(database.release()));
+}
+
+MEX_DEFINE(env_new) (int nlhs, mxArray* plhs[],
+                     int nrhs, const mxArray* prhs[]) {
+  InputArguments input(nrhs, prhs, 1, 20, "MODE", "FIXEDMAP", "NOSUBDIR",
+      "NOSYNC", "RDONLY", "NOMETASYNC", "WRITEMAP", "MAPASYNC", "NOTLS",
+      "NOLOCK", "NORDAHEAD", "NOMEMINIT", "MAPSIZE", "MAXREADERS", "MAXDBS",
+      "ASYNC", "QUEUESIZE", "COMMITSIZE", "COMMITINTERVAL", "GROWTHPOLICY");
+  OutputArguments output(nlhs, plhs, 1);
+  unique_ptr<Database> database(new Database);
+  ASSERT(database.get() != NULL, "Null pointer exception.");
+  bool read_only = openEnvironment(input, 16,
+                                   database->getEnvironment().get());
+  // The unnamed table always exists and holds the names of the others.
   Transaction transaction(database.get(), NULL, (read_only) ? MDB_RDONLY : 0);
-  transaction.openDatabase(input.get<string>("NAME", ""), flags);
+  transaction.openDatabase("", 0);
   transaction.commit();
   output.set(0, Session<Database>::create(database.release()));
 }
 
+MEX_DEFINE(table_new) (int nlhs, mxArray* plhs[],
+                       int nrhs, const mxArray* prhs[]) {
+  InputArguments input(nrhs, prhs, 2, 10, "REVERSEKEY", "DUPSORT",
+      "INTEGERKEY", "DUPFIXED", "INTEGERDUP", "REVERSEDUP", "CREATE",
+      "CACHESIZE", "BLOOMBITS", "ORDINAL");
+  OutputArguments output(nlhs, plhs, 1);
+  Database* environment = Session<Database>::get(input.get(0));
+  unique_ptr<Database> database(
+      new Database(environment->getEnvironment()));
+  ASSERT(database.get() != NULL, "Null pointer exception.");
+  unsigned int flags = 0;
+  int status = mdb_env_get_flags(database->getEnv(), &flags);
+  ASSERT(status == MDB_SUCCESS, mdb_strerror(status));
+  string name(input.get<string>(1));
+  ASSERT(!name.empty(), "Table name must not be empty.");
+  openTable(input, name, flags & MDB_RDONLY, database.get());
+  output.set(0, Session<Database>::create(database.release()));
+}
+
 MEX_DEFINE(delete) (int nlhs, mxArray* plhs[],
                     int nrhs, const mxArray* prhs[]) {
   InputArguments input(nrhs, prhs, 1);
@@ -344,32 +3841,166 @@ MEX_DEFINE(delete) (int nlhs, mxArray* plhs[],
 
 MEX_DEFINE(get) (int nlhs, mxArray* plhs[],
                  int nrhs, const mxArray* prhs[]) {
-  InputArguments input(nrhs, prhs, 2);
+  InputArguments input(nrhs, prhs, 2, 3, "TYPE", "SIZE", "SERIALIZE");
   OutputArguments output(nlhs, plhs, 1);
   Database* database = Session<Database>::get(input.get(0));
-  Record key = input.get<Record>(1);
+  ValueFormat format(input);
+  Record key;
+  getSingleKey(input.get(1), database->getFlags(), &key);
+  BloomFilter* filter = getBloomFilter(database);
+  if (filter && !filter->mayContain(key)) {
+    output.set(0, format.decode(Record()));
+    return;
+  }
+  ValueCache* cache = database->getValueCache();
+  size_t id = 0;
+  string cache_key;
+  if (cache) {
+    id = database->getLastTransactionID();
+    cache_key = format.getSignature() + string(key.begin(), key.end());
+    const mxArray* cached = cache->get(id, cache_key);
+    if (cached) {
+      mxArray* array = mxDuplicateArray(cached);
+      MEXPLUS_CHECK_NOTNULL(array);
+      output.set(0, array);
+      return;
+    }
+  }
   Record value;
-  Transaction transaction(database, NULL, MDB_RDONLY);
-  transaction.getRecord(&key, &value);
+  Transaction transaction;
+  transaction.renew(database);
+  bool found = transaction.getRecord(&key, &value);
+  mxArray* array = format.decode(value);
+  // Cache the value only if the snapshot is of the ID.
+  if (cache && found && database->getLastTransactionID() == id)
+    cache->put(id, cache_key, array);
+  output.set(0, array);
+  transaction.commit();
+}
+
+MEX_DEFINE(mget) (int nlhs, mxArray* plhs[],
+                  int nrhs, const mxArray* prhs[]) {
+  InputArguments input(nrhs, prhs, 2, 3, "TYPE", "SIZE", "SERIALIZE");
+  OutputArguments output(nlhs, plhs, 2);
+  Database* database = Session<Database>::get(input.get(0));
+  ValueFormat format(input);
+  const mxArray* keys = input.get(1);
+  mwSize size = getKeySize(keys);
+  MxArray values(MxArray::Cell(1, size));
+  MxArray found(MxArray::Logical(1, size));
+  BloomFilter* filter = getBloomFilter(database);
+  ValueCache* cache = database->getValueCache();
+  size_t id = (cache) ? database->getLastTransactionID() : 0;
+  Transaction transaction;
+  transaction.renew(database);
+  // Cache the values only if the snapshot is of the ID.
+  if (cache && database->getLastTransactionID() != id)
+    cache = NULL;
+  string signature = (cache) ? format.getSignature() : string();
+  for (mwIndex i = 0; i < size; ++i) {
+    Record key;
+    Record value;
+    getKey(keys, i, database->getFlags(), &key);
+    if (filter && !filter->mayContain(key)) {
+      values.set(i, format.decode(value));
+      continue;
+    }
+    string cache_key;
+    if (cache) {
+      cache_key = signature + string(key.begin(), key.end());
+      const mxArray* cached = cache->get(id, cache_key);
+      if (cached) {
+        mxArray* array = mxDuplicateArray(cached);
+        MEXPLUS_CHECK_NOTNULL(array);
+        found.set(i, true);
+        values.set(i, array);
+        continue;
+      }
+    }
+    bool exists = transaction.getRecord(&key, &value);
+    mxArray* array = format.decode(value);
+    if (cache && exists)
+      cache->put(id, cache_key, array);
+    found.set(i, exists);
+    values.set(i, array);
+  }
+  transaction.commit();
+  output.set(0, values.release());
+  output.set(1, found.release());
+}
+
+MEX_DEFINE(exists) (int nlhs, mxArray* plhs[],
+                    int nrhs, const mxArray* prhs[]) {
+  InputArguments input(nrhs, prhs, 2);
+  OutputArguments output(nlhs, plhs, 1);
+  Database* database = Session<Database>::get(input.get(0));
+  const mxArray* keys = input.get(1);
+  mwSize size = getKeySize(keys);
+  MxArray found(MxArray::Logical(1, size));
+  BloomFilter* filter = getBloomFilter(database);
+  // Start a transaction only for the keys that may exist.
+  Transaction transaction;
+  for (mwIndex i = 0; i < size; ++i) {
+    Record key;
+    Record value;
+    getKey(keys, i, database->getFlags(), &key);
+    if (filter && !filter->mayContain(key))
+      continue;
+    if (!transaction.get())
+      transaction.renew(database);
+    found.set(i, transaction.getRecord(&key, &value));
+  }
+  transaction.commit();
+  output.set(0, found.release());
+}
+
+MEX_DEFINE(mget_datum) (int nlhs, mxArray* plhs[],
+                        int nrhs, const mxArray* prhs[]) {
+  InputArguments input(nrhs, prhs, 2);
+  OutputArguments output(nlhs, plhs, 2);
+  Database* database = Session<Database>::get(input.get(0));
+  const mxArray* keys = input.get(1);
+  mwSize size = getKeySize(keys);
+  vector<Datum> datums(size);
+  Transaction transaction;
+  transaction.renew(database);
+  for (mwIndex i = 0; i < size; ++i) {
+    Record key;
+    Record value;
+    getKey(keys, i, database->getFlags(), &key);
+    ASSERT(transaction.getRecord(&key, &value), "Record not found: %s.",
+           string(key.begin(), key.end()).c_str());
+    ASSERT(datums[i].parse(value), "Invalid Datum record.");
+  }
+  mxArray* images = NULL;
+  mxArray* labels = NULL;
+  createDatumBatch(datums, &images, &labels);
   transaction.commit();
-  output.set(0, value);
+  output.set(0, images);
+  output.set(1, labels);
 }
 
 MEX_DEFINE(put) (int nlhs, mxArray* plhs[],
                  int nrhs, const mxArray* prhs[]) {
-  InputArguments input(nrhs, prhs, 3, 4, "NODUPDATA", "NOOVERWRITE", "RESERVE",
-      "APPEND");
+  InputArguments input(nrhs, prhs, 3, 5, "NODUPDATA", "NOOVERWRITE", "RESERVE",
+      "APPEND", "SERIALIZE");
   OutputArguments output(nlhs, plhs, 0);
   Database* database = Session<Database>::get(input.get(0));
   unsigned int flags = OPTIONFLAG(NODUPDATA, false) |
                        OPTIONFLAG(NOOVERWRITE, false) |
                        OPTIONFLAG(RESERVE, false) |
                        OPTIONFLAG(APPEND, false);
-  Record key = input.get<Record>(1);
-  Record value = input.get<Record>(2);
-  Transaction transaction(database, NULL, 0);
-  transaction.putRecord(&key, &value, flags);
-  transaction.commit();
+  Record key;
+  getSingleKey(input.get(1), database->getFlags(), &key);
+  Record value;
+  getValue(input.get(2), input.get<bool>("SERIALIZE", false), &value);
+  if (database->isAsync()) {
+    database->queuePut(&key, &value, flags);
+    return;
+  }
+  writeRecords(database, [&](Transaction* transaction) {
+    return transaction->putRecord(&key, &value, flags);
+  });
 }
 
 MEX_DEFINE(remove) (int nlhs, mxArray* plhs[],
@@ -377,23 +4008,178 @@ MEX_DEFINE(remove) (int nlhs, mxArray* plhs[],
   InputArguments input(nrhs, prhs, 2);
   OutputArguments output(nlhs, plhs, 0);
   Database* database = Session<Database>::get(input.get(0));
-  Record key = input.get<Record>(1);
-  Transaction transaction(database, NULL, 0);
-  transaction.removeRecord(&key);
+  Record key;
+  getSingleKey(input.get(1), database->getFlags(), &key);
+  if (database->isAsync()) {
+    database->queueRemove(&key);
+    return;
+  }
+  writeRecords(database, [&](Transaction* transaction) {
+    return transaction->removeRecord(&key);
+  });
+}
+
+MEX_DEFINE(mput) (int nlhs, mxArray* plhs[],
+                  int nrhs, const mxArray* prhs[]) {
+  InputArguments input(nrhs, prhs, 3, 5, "NODUPDATA", "NOOVERWRITE", "RESERVE",
+      "APPEND", "SERIALIZE");
+  OutputArguments output(nlhs, plhs, 0);
+  Database* database = Session<Database>::get(input.get(0));
+  unsigned int flags = OPTIONFLAG(NODUPDATA, false) |
+                       OPTIONFLAG(NOOVERWRITE, false) |
+                       OPTIONFLAG(RESERVE, false) |
+                       OPTIONFLAG(APPEND, false);
+  const mxArray* keys = input.get(1);
+  const mxArray* values = input.get(2);
+  mwSize size = getKeySize(keys);
+  bool serialize = input.get<bool>("SERIALIZE", false);
+  ASSERT(mxIsCell(values) && mxGetNumberOfElements(values) == size,
+         "Values must be a cell array of the same size as keys.");
+  if (database->isAsync()) {
+    for (mwIndex i = 0; i < size; ++i) {
+      Record key;
+      Record value;
+      getKey(keys, i, database->getFlags(), &key);
+      getValue(mxGetCell(values, i), serialize, &value);
+      database->queuePut(&key, &value, flags);
+    }
+    return;
+  }
+  writeRecords(database, [&](Transaction* transaction) {
+    for (mwIndex i = 0; i < size; ++i) {
+      Record key;
+      Record value;
+      getKey(keys, i, database->getFlags(), &key);
+      getValue(mxGetCell(values, i), serialize, &value);
+      if (!transaction->putRecord(&key, &value, flags))
+        return false;
+    }
+    return true;
+  });
+}
+
+MEX_DEFINE(mremove) (int nlhs, mxArray* plhs[],
+                     int nrhs, const mxArray* prhs[]) {
+  InputArguments input(nrhs, prhs, 2);
+  OutputArguments output(nlhs, plhs, 0);
+  Database* database = Session<Database>::get(input.get(0));
+  const mxArray* keys = input.get(1);
+  mwSize size = getKeySize(keys);
+  if (database->isAsync()) {
+    for (mwIndex i = 0; i < size; ++i) {
+      Record key;
+      getKey(keys, i, database->getFlags(), &key);
+      database->queueRemove(&key);
+    }
+    return;
+  }
+  writeRecords(database, [&](Transaction* transaction) {
+    for (mwIndex i = 0; i < size; ++i) {
+      Record key;
+      getKey(keys, i, database->getFlags(), &key);
+      if (!transaction->removeRecord(&key))
+        return false;
+    }
+    return true;
+  });
+}
+
+MEX_DEFINE(flush) (int nlhs, mxArray* plhs[],
+                   int nrhs, const mxArray* prhs[]) {
+  InputArguments input(nrhs, prhs, 1);
+  OutputArguments output(nlhs, plhs, 0);
+  Database* database = Session<Database>::get(input.get(0));
+  database->flush();
+}
+
+MEX_DEFINE(load) (int nlhs, mxArray* plhs[],
+                  int nrhs, const mxArray* prhs[]) {
+  InputArguments input(nrhs, prhs, 3, 2, "CHUNKSIZE", "SERIALIZE");
+  OutputArguments output(nlhs, plhs, 0);
+  Database* database = Session<Database>::get(input.get(0));
+  const mxArray* keys = input.get(1);
+  const mxArray* values = input.get(2);
+  mwSize size = getKeySize(keys);
+  size_t chunk_size = input.get<size_t>("CHUNKSIZE", 100000);
+  bool serialize = input.get<bool>("SERIALIZE", false);
+  ASSERT(mxIsCell(values) && mxGetNumberOfElements(values) == size,
+         "Values must be a cell array of the same size as keys.");
+  ASSERT(chunk_size > 0, "CHUNKSIZE must be positive.");
+  vector<Record> key_records(size);
+  for (mwIndex i = 0; i < size; ++i)
+    getKey(keys, i, database->getFlags(), &key_records[i]);
+  // Sort in the key order of the database, keeping the input order of the
+  // same keys so that the last one wins.
+  vector<size_t> order(size);
+  iota(order.begin(), order.end(), 0);
+  Transaction transaction;
+  transaction.renew(database);
+  bool duplicates = transaction.getFlags() & MDB_DUPSORT;
+  stable_sort(order.begin(), order.end(), [&](size_t i, size_t j) {
+    return transaction.compare(&key_records[i], &key_records[j]) < 0;
+  });
   transaction.commit();
+  // Append in chunks. Keys not after the existing last key are put normally.
+  Record last_key;
+  Record* previous_key = NULL;
+  bool appendable = false;
+  size_t offset = 0;
+  while (offset < size) {
+    // State to restore when the chunk runs again in a grown map.
+    size_t begin = offset;
+    Record* begin_key = previous_key;
+    bool begin_appendable = appendable;
+    writeRecords(database, [&](Transaction* transaction) {
+      offset = begin;
+      previous_key = begin_key;
+      appendable = begin_appendable;
+      if (offset == 0) {
+        Cursor cursor;
+        cursor.open(transaction->get(), database->getDBI());
+        appendable = !cursor.get(MDB_LAST);
+        if (!appendable)
+          last_key.initialize(string(cursor.getKey()->begin(),
+                                     cursor.getKey()->end()));
+        cursor.close();
+      }
+      size_t end = min(offset + chunk_size, static_cast<size_t>(size));
+      for (; offset < end; ++offset) {
+        Record* key = &key_records[order[offset]];
+        if (!duplicates && offset + 1 < size &&
+            transaction->compare(key, &key_records[order[offset + 1]]) == 0)
+          continue;
+        if (!appendable)
+          appendable = transaction->compare(key, &last_key) > 0;
+        Record value;
+        getValue(mxGetCell(values, order[offset]), serialize, &value);
+        bool append = appendable && (previous_key == NULL ||
+            transaction->compare(key, previous_key) != 0);
+        if (!transaction->putRecord(key, &value, (append) ? MDB_APPEND : 0))
+          return false;
+        previous_key = key;
+      }
+      return true;
+    });
+  }
 }
 
 MEX_DEFINE(each) (int nlhs, mxArray* plhs[],
                   int nrhs, const mxArray* prhs[]) {
-  InputArguments input(nrhs, prhs, 2);
+  InputArguments input(nrhs, prhs, 2, 4, "CHUNKSIZE", "TYPE", "SIZE",
+      "SERIALIZE");
   OutputArguments output(nlhs, plhs, 0);
   Database* database = Session<Database>::get(input.get(0));
-  Transaction transaction(database, NULL, MDB_RDONLY);
+  size_t chunk_size = input.get<size_t>("CHUNKSIZE", 0);
+  ValueFormat format(input);
+  Transaction transaction;
+  transaction.renew(database);
   Cursor cursor;
   cursor.open(transaction.get(), database->getDBI());
-  while (cursor.get(MDB_NEXT)) {
-    MxArray key_array(*cursor.getKey());
-    MxArray value_array(*cursor.getValue());
+  mxArray* keys = NULL;
+  mxArray* values = NULL;
+  while (readCallbackArguments(&cursor, chunk_size, format, &keys, &values)) {
+    MxArray key_array(keys);
+    MxArray value_array(values);
     mxArray* prhs[] = {const_cast<mxArray*>(input.get(1)),
                        const_cast<mxArray*>(key_array.get()),
                        const_cast<mxArray*>(value_array.get())};
@@ -405,16 +4191,22 @@ MEX_DEFINE(each) (int nlhs, mxArray* plhs[],
 
 MEX_DEFINE(reduce) (int nlhs, mxArray* plhs[],
                     int nrhs, const mxArray* prhs[]) {
-  InputArguments input(nrhs, prhs, 3);
+  InputArguments input(nrhs, prhs, 3, 4, "CHUNKSIZE", "TYPE", "SIZE",
+      "SERIALIZE");
   OutputArguments output(nlhs, plhs, 1);
   Database* database = Session<Database>::get(input.get(0));
+  size_t chunk_size = input.get<size_t>("CHUNKSIZE", 0);
+  ValueFormat format(input);
   MxArray accumulation(input.get(2));
-  Transaction transaction(database, NULL, MDB_RDONLY);
+  Transaction transaction;
+  transaction.renew(database);
   Cursor cursor;
   cursor.open(transaction.get(), database->getDBI());
-  while (cursor.get(MDB_NEXT)) {
-    MxArray key_array(*cursor.getKey());
-    MxArray value_array(*cursor.getValue());
+  mxArray* keys = NULL;
+  mxArray* values = NULL;
+  while (readCallbackArguments(&cursor, chunk_size, format, &keys, &values)) {
+    MxArray key_array(keys);
+    MxArray value_array(values);
     mxArray* lhs = NULL;
     mxArray* prhs[] = {const_cast<mxArray*>(input.get(1)),
                        const_cast<mxArray*>(key_array.get()),
@@ -450,7 +4242,8 @@ MEX_DEFINE(txn_commit) (int nlhs, mxArray* plhs[],
   InputArguments input(nrhs, prhs, 1);
   OutputArguments output(nlhs, plhs, 0);
   Transaction* transaction = Session<Transaction>::get(input.get(0));
-  transaction->commit();
+  if (!transaction->commit())
+    retryInGrownMap(transaction);
 }
 
 MEX_DEFINE(txn_abort) (int nlhs, mxArray* plhs[],
@@ -463,37 +4256,48 @@ MEX_DEFINE(txn_abort) (int nlhs, mxArray* plhs[],
 
 MEX_DEFINE(txn_get) (int nlhs, mxArray* plhs[],
                      int nrhs, const mxArray* prhs[]) {
-  InputArguments input(nrhs, prhs, 2);
+  InputArguments input(nrhs, prhs, 2, 4, "TYPE", "SIZE", "SERIALIZE",
+      "TABLE");
   OutputArguments output(nlhs, plhs, 1);
   Transaction* transaction = Session<Transaction>::get(input.get(0));
-  Record key = input.get<Record>(1);
+  ValueFormat format(input);
+  Database* table = getTable(input);
+  Record key;
+  getSingleKey(input.get(1), getFlags(transaction, table), &key);
   Record value;
-  transaction->getRecord(&key, &value);
-  output.set(0, value);
+  transaction->getRecord(&key, &value, table);
+  output.set(0, format.decode(value));
 }
 
 MEX_DEFINE(txn_put) (int nlhs, mxArray* plhs[],
                      int nrhs, const mxArray* prhs[]) {
-  InputArguments input(nrhs, prhs, 3, 4, "NODUPDATA", "NOOVERWRITE", "RESERVE",
-      "APPEND");
+  InputArguments input(nrhs, prhs, 3, 6, "NODUPDATA", "NOOVERWRITE", "RESERVE",
+      "APPEND", "SERIALIZE", "TABLE");
   OutputArguments output(nlhs, plhs, 0);
   Transaction* transaction = Session<Transaction>::get(input.get(0));
   unsigned int flags = OPTIONFLAG(NODUPDATA, false) |
                        OPTIONFLAG(NOOVERWRITE, false) |
                        OPTIONFLAG(RESERVE, false) |
                        OPTIONFLAG(APPEND, false);
-  Record key = input.get<Record>(1);
-  Record value = input.get<Record>(2);
-  transaction->putRecord(&key, &value, flags);
+  Database* table = getTable(input);
+  Record key;
+  getSingleKey(input.get(1), getFlags(transaction, table), &key);
+  Record value;
+  getValue(input.get(2), input.get<bool>("SERIALIZE", false), &value);
+  if (!transaction->putRecord(&key, &value, flags, table))
+    retryInGrownMap(transaction);
 }
 
 MEX_DEFINE(txn_remove) (int nlhs, mxArray* plhs[],
                         int nrhs, const mxArray* prhs[]) {
-  InputArguments input(nrhs, prhs, 2);
+  InputArguments input(nrhs, prhs, 2, 1, "TABLE");
   OutputArguments output(nlhs, plhs, 0);
   Transaction* transaction = Session<Transaction>::get(input.get(0));
-  Record key = input.get<Record>(1);
-  transaction->removeRecord(&key);
+  Database* table = getTable(input);
+  Record key;
+  getSingleKey(input.get(1), getFlags(transaction, table), &key);
+  if (!transaction->removeRecord(&key, table))
+    retryInGrownMap(transaction);
 }
 
 MEX_DEFINE(cursor_new) (int nlhs, mxArray* plhs[],
@@ -503,7 +4307,7 @@ MEX_DEFINE(cursor_new) (int nlhs, mxArray* plhs[],
   Transaction* transaction = Session<Transaction>::get(input.get(0));
   Database* database = Session<Database>::get(input.get(1));
   unique_ptr<Cursor> cursor(new Cursor);
-  cursor->open(transaction->get(), database->getDBI());
+  cursor->open(transaction, database);
   output.set(0, Session<Cursor>::create(cursor.release()));
 }
 
@@ -551,16 +4355,65 @@ MEX_DEFINE(cursor_find) (int nlhs, mxArray* plhs[],
   InputArguments input(nrhs, prhs, 2);
   OutputArguments output(nlhs, plhs, 1);
   Cursor* cursor = Session<Cursor>::get(input.get(0));
-  input.get<Record>(1, cursor->getKey());
+  getSingleKey(input.get(1), cursor->getFlags(), cursor->getKey());
   output.set(0, cursor->get(MDB_SET));
 }
 
+MEX_DEFINE(cursor_fetch) (int nlhs, mxArray* plhs[],
+                          int nrhs, const mxArray* prhs[]) {
+  InputArguments input(nrhs, prhs, 2, 5, "REVERSE", "TYPE", "SIZE",
+      "SERIALIZE", "KEYTYPE");
+  OutputArguments output(nlhs, plhs, 3);
+  Cursor* cursor = Session<Cursor>::get(input.get(0));
+  size_t size = input.get<size_t>(1);
+  ValueFormat format(input);
+  KeyFormat key_format(input, cursor->getFlags());
+  MDB_cursor_op operation = (input.get<bool>("REVERSE", false)) ?
+      MDB_PREV : MDB_NEXT;
+  bool fetch_values = output.size() > 1;
+  vector<Record> keys;
+  vector<mxArray*> values;
+  while (keys.size() < size && cursor->get(operation)) {
+    keys.push_back(*cursor->getKey());
+    if (fetch_values)
+      values.push_back(format.decode(*cursor->getValue()));
+  }
+  output.set(0, key_format.decode(keys));
+  output.set(1, createCell(values));
+  output.set(2, static_cast<double>(keys.size()));
+}
+
+MEX_DEFINE(cursor_fetch_datum) (int nlhs, mxArray* plhs[],
+                                int nrhs, const mxArray* prhs[]) {
+  InputArguments input(nrhs, prhs, 2, 1, "REVERSE");
+  OutputArguments output(nlhs, plhs, 3);
+  Cursor* cursor = Session<Cursor>::get(input.get(0));
+  size_t size = input.get<size_t>(1);
+  MDB_cursor_op operation = (input.get<bool>("REVERSE", false)) ?
+      MDB_PREV : MDB_NEXT;
+  vector<string> keys;
+  vector<Datum> datums;
+  while (keys.size() < size && cursor->get(operation)) {
+    Record* key = cursor->getKey();
+    keys.push_back(string(key->begin(), key->end()));
+    datums.push_back(Datum());
+    ASSERT(datums.back().parse(*cursor->getValue()), "Invalid Datum record.");
+  }
+  mxArray* images = NULL;
+  mxArray* labels = NULL;
+  createDatumBatch(datums, &images, &labels);
+  output.set(0, images);
+  output.set(1, labels);
+  output.set(2, keys);
+}
+
 MEX_DEFINE(cursor_getkey) (int nlhs, mxArray* plhs[],
                            int nrhs, const mxArray* prhs[]) {
-  InputArguments input(nrhs, prhs, 1);
+  InputArguments input(nrhs, prhs, 1, 1, "KEYTYPE");
   OutputArguments output(nlhs, plhs, 1);
   Cursor* cursor = Session<Cursor>::get(input.get(0));
-  output.set(0, *cursor->getKey());
+  KeyFormat key_format(input, cursor->getFlags());
+  output.set(0, key_format.decode(*cursor->getKey()));
 }
 
 MEX_DEFINE(cursor_setkey) (int nlhs, mxArray* plhs[],
@@ -569,7 +4422,7 @@ MEX_DEFINE(cursor_setkey) (int nlhs, mxArray* plhs[],
       "RESERVE", "APPEND", "APPENDDUP", "MULTIPLE");
   OutputArguments output(nlhs, plhs, 0);
   Cursor* cursor = Session<Cursor>::get(input.get(0));
-  input.get<Record>(1, cursor->getKey());
+  getSingleKey(input.get(1), cursor->getFlags(), cursor->getKey());
   cursor->getValue()->sync();
   unsigned int flags = OPTIONFLAG(CURRENT, true) |
                        OPTIONFLAG(NODUPDATA, false) |
@@ -578,25 +4431,29 @@ MEX_DEFINE(cursor_setkey) (int nlhs, mxArray* plhs[],
                        OPTIONFLAG(APPEND, false) |
                        OPTIONFLAG(APPENDDUP, false) |
                        OPTIONFLAG(MULTIPLE, false);
+  ASSERT(!(flags & MDB_MULTIPLE), "Use putMultiple for MULTIPLE.");
   cursor->put(flags);
 }
 
 MEX_DEFINE(cursor_getvalue) (int nlhs, mxArray* plhs[],
                              int nrhs, const mxArray* prhs[]) {
-  InputArguments input(nrhs, prhs, 1);
+  InputArguments input(nrhs, prhs, 1, 3, "TYPE", "SIZE", "SERIALIZE");
   OutputArguments output(nlhs, plhs, 1);
   Cursor* cursor = Session<Cursor>::get(input.get(0));
-  output.set(0, *cursor->getValue());
+  ValueFormat format(input);
+  output.set(0, format.decode(*cursor->getValue()));
 }
 
 MEX_DEFINE(cursor_setvalue) (int nlhs, mxArray* plhs[],
                              int nrhs, const mxArray* prhs[]) {
-  InputArguments input(nrhs, prhs, 2, 7, "CURRENT", "NODUPDATA", "NOOVERWRITE",
-      "RESERVE", "APPEND", "APPENDDUP", "MULTIPLE");
+  InputArguments input(nrhs, prhs, 2, 8, "CURRENT", "NODUPDATA", "NOOVERWRITE",
+      "RESERVE", "APPEND", "APPENDDUP", "MULTIPLE", "SERIALIZE");
   OutputArguments output(nlhs, plhs, 0);
   Cursor* cursor = Session<Cursor>::get(input.get(0));
-  input.get<Record>(1, cursor->getValue());
+  getValue(input.get(1), input.get<bool>("SERIALIZE", false),
+           cursor->getValue());
   cursor->getKey()->sync();
+  cursor->getValue()->sync();
   unsigned int flags = OPTIONFLAG(CURRENT, true) |
                        OPTIONFLAG(NODUPDATA, false) |
                        OPTIONFLAG(NOOVERWRITE, false) |
@@ -604,9 +4461,54 @@ MEX_DEFINE(cursor_setvalue) (int nlhs, mxArray* plhs[],
                        OPTIONFLAG(APPEND, false) |
                        OPTIONFLAG(APPENDDUP, false) |
                        OPTIONFLAG(MULTIPLE, false);
+  ASSERT(!(flags & MDB_MULTIPLE), "Use putMultiple for MULTIPLE.");
   cursor->put(flags);
 }
 
+MEX_DEFINE(cursor_getmultiple) (int nlhs, mxArray* plhs[],
+                                int nrhs, const mxArray* prhs[]) {
+  InputArguments input(nrhs, prhs, 1, 1, "TYPE");
+  OutputArguments output(nlhs, plhs, 1);
+  Cursor* cursor = Session<Cursor>::get(input.get(0));
+  ValueFormat format(input.get<string>("TYPE", "uint8"));
+  bool fixed = cursor->getFlags() & MDB_DUPFIXED;
+  size_t count = cursor->count();
+  ASSERT(cursor->get(MDB_FIRST_DUP), "Record not found.");
+  Record* value = cursor->getValue();
+  size_t size = value->end() - value->begin();
+  MxArray values(format.createColumns(size, count));
+  // DUPFIXED duplicates are read a page at a time.
+  size_t offset = 0;
+  bool found = (fixed) ? cursor->get(MDB_GET_MULTIPLE) : true;
+  while (found) {
+    size_t page_size = value->end() - value->begin();
+    ASSERT(fixed || page_size == size, "Duplicates must have the same size.");
+    ASSERT(offset + page_size <= size * count, "Duplicates changed.");
+    format.copy(*value, const_cast<mxArray*>(values.get()), offset);
+    offset += page_size;
+    found = cursor->get((fixed) ? MDB_NEXT_MULTIPLE : MDB_NEXT_DUP);
+  }
+  output.set(0, values.release());
+}
+
+MEX_DEFINE(cursor_putmultiple) (int nlhs, mxArray* plhs[],
+                                int nrhs, const mxArray* prhs[]) {
+  InputArguments input(nrhs, prhs, 3, 2, "NODUPDATA", "APPENDDUP");
+  OutputArguments output(nlhs, plhs, 1);
+  Cursor* cursor = Session<Cursor>::get(input.get(0));
+  getSingleKey(input.get(1), cursor->getFlags(), cursor->getKey());
+  cursor->getKey()->sync();
+  const mxArray* array = input.get(2);
+  Record values;
+  values.initialize(array);
+  size_t columns = mxGetN(array);
+  size_t size = (columns > 0) ? (values.end() - values.begin()) / columns : 0;
+  ASSERT(size > 0, "Values must not be empty.");
+  unsigned int flags = OPTIONFLAG(NODUPDATA, false) |
+                       OPTIONFLAG(APPENDDUP, false);
+  output.set(0, cursor->putMultiple(values.begin(), size, columns, flags));
+}
+
 MEX_DEFINE(cursor_remove) (int nlhs, mxArray* plhs[],
                            int nrhs, const mxArray* prhs[]) {
   InputArguments input(nrhs, prhs, 1);
@@ -616,40 +4518,181 @@ MEX_DEFINE(cursor_remove) (int nlhs, mxArray* plhs[],
   cursor->remove(flags);
 }
 
+MEX_DEFINE(loader_new) (int nlhs, mxArray* plhs[],
+                        int nrhs, const mxArray* prhs[]) {
+  InputArguments input(nrhs, prhs, 1, 14, "BATCHSIZE", "SHUFFLE", "DATUM",
+      "SEED", "PREFETCH", "THREADS", "TYPE", "SIZE", "SERIALIZE", "START",
+      "END", "PREFIX", "LIMIT", "REVERSE");
+  OutputArguments output(nlhs, plhs, 1);
+  Database* database = Session<Database>::get(input.get(0));
+  output.set(0, Session<DataLoader>::create(new DataLoader(database, input)));
+}
+
+MEX_DEFINE(loader_delete) (int nlhs, mxArray* plhs[],
+                           int nrhs, const mxArray* prhs[]) {
+  InputArguments input(nrhs, prhs, 1);
+  OutputArguments output(nlhs, plhs, 0);
+  Session<DataLoader>::destroy(input.get(0));
+}
+
+MEX_DEFINE(loader_next) (int nlhs, mxArray* plhs[],
+                         int nrhs, const mxArray* prhs[]) {
+  InputArguments input(nrhs, prhs, 1);
+  OutputArguments output(nlhs, plhs, 4);
+  DataLoader* loader = Session<DataLoader>::get(input.get(0));
+  loader->next(&output);
+}
+
+MEX_DEFINE(loader_size) (int nlhs, mxArray* plhs[],
+                         int nrhs, const mxArray* prhs[]) {
+  InputArguments input(nrhs, prhs, 1);
+  OutputArguments output(nlhs, plhs, 1);
+  DataLoader* loader = Session<DataLoader>::get(input.get(0));
+  output.set(0, static_cast<double>(loader->getSize()));
+}
+
 MEX_DEFINE(keys) (int nlhs, mxArray* plhs[],
                   int nrhs, const mxArray* prhs[]) {
-  InputArguments input(nrhs, prhs, 1);
+  InputArguments input(nrhs, prhs, 1, 10, "START", "END", "PREFIX", "LIMIT",
+      "REVERSE", "THREADS", "KEYTYPE", "PACKED", "CACHE", "CACHEFILE");
+  OutputArguments output(nlhs, plhs, 1);
+  Database* database = Session<Database>::get(input.get(0));
+  KeyFormat key_format(input, database->getFlags(),
+                       input.get<bool>("PACKED", false));
+  string filename = input.get<string>("CACHEFILE", "");
+  if (input.get<bool>("CACHE", false) || !filename.empty()) {
+    ASSERT(!input.get("START") && !input.get("END") && !input.get("PREFIX") &&
+           !input.get("LIMIT") && !input.get("REVERSE"),
+           "CACHE does not support range options.");
+    shared_ptr<KeyCache> cache = getKeyCache(database, filename);
+    output.set(0, key_format.decode(cache->getKeys()));
+    return;
+  }
+  mxArray* keys = NULL;
+  scanRange(database, input, key_format, &keys, NULL);
+  output.set(0, keys);
+}
+
+MEX_DEFINE(values) (int nlhs, mxArray* plhs[],
+                    int nrhs, const mxArray* prhs[]) {
+  InputArguments input(nrhs, prhs, 1, 9, "START", "END", "PREFIX", "LIMIT",
+      "REVERSE", "THREADS", "TYPE", "SIZE", "SERIALIZE");
   OutputArguments output(nlhs, plhs, 1);
   Database* database = Session<Database>::get(input.get(0));
-  Transaction transaction(database, NULL, MDB_RDONLY);
+  mxArray* values = NULL;
+  scanRange(database, input, KeyFormat(), NULL, &values);
+  output.set(0, values);
+}
+
+MEX_DEFINE(scan) (int nlhs, mxArray* plhs[],
+                  int nrhs, const mxArray* prhs[]) {
+  InputArguments input(nrhs, prhs, 1, 10, "START", "END", "PREFIX", "LIMIT",
+      "REVERSE", "THREADS", "TYPE", "SIZE", "SERIALIZE", "KEYTYPE");
+  OutputArguments output(nlhs, plhs, 2);
+  Database* database = Session<Database>::get(input.get(0));
+  mxArray* keys = NULL;
+  mxArray* values = NULL;
+  scanRange(database, input, KeyFormat(input, database->getFlags()), &keys,
+            (output.size() > 1) ? &values : NULL);
+  output.set(0, keys);
+  output.set(1, values);
+}
+
+MEX_DEFINE(sample) (int nlhs, mxArray* plhs[],
+                    int nrhs, const mxArray* prhs[]) {
+  InputArguments input(nrhs, prhs, 2, 5, "SEED", "TYPE", "SIZE", "SERIALIZE",
+      "KEYTYPE");
+  OutputArguments output(nlhs, plhs, 2);
+  Database* database = Session<Database>::get(input.get(0));
+  ValueFormat format(input);
+  KeyFormat key_format(input, database->getFlags());
+  Transaction transaction;
+  shared_ptr<OrdinalIndex> index = getOrdinalIndex(database, &transaction);
+  size_t size = min(input.get<size_t>(1), index->size());
+  Permutation order(index->size(),
+                    input.get<double>("SEED", random_device()()));
   Cursor cursor;
   cursor.open(transaction.get(), database->getDBI());
-  vector<string> key_values;
-  while (cursor.get(MDB_NEXT)) {
-    Record* key = cursor.getKey();
-    key_values.push_back(string(key->begin(), key->end()));
+  size_t position = index->size();
+  vector<Record> keys(size);
+  vector<mxArray*> values(size);
+  for (size_t i = 0; i < size; ++i) {
+    Record value;
+    int status = index->seek(cursor.get(), order(i), &position,
+                             keys[i].get(), value.get());
+    ASSERT(status == MDB_SUCCESS, mdb_strerror(status));
+    values[i] = format.decode(value);
   }
+  output.set(0, createCell(values));
+  output.set(1, key_format.decode(keys));
   cursor.close();
   transaction.commit();
-  output.set(0, key_values);
 }
 
-MEX_DEFINE(values) (int nlhs, mxArray* plhs[],
-                    int nrhs, const mxArray* prhs[]) {
-  InputArguments input(nrhs, prhs, 1);
-  OutputArguments output(nlhs, plhs, 1);
+MEX_DEFINE(range_at) (int nlhs, mxArray* plhs[],
+                      int nrhs, const mxArray* prhs[]) {
+  InputArguments input(nrhs, prhs, 3, 4, "TYPE", "SIZE", "SERIALIZE",
+      "KEYTYPE");
+  OutputArguments output(nlhs, plhs, 2);
   Database* database = Session<Database>::get(input.get(0));
-  Transaction transaction(database, NULL, MDB_RDONLY);
+  ValueFormat format(input);
+  KeyFormat key_format(input, database->getFlags());
+  Transaction transaction;
+  shared_ptr<OrdinalIndex> index = getOrdinalIndex(database, &transaction);
+  // Indices are one-based and inclusive.
+  double first = input.get<double>(1);
+  double last = input.get<double>(2);
+  ASSERT(last < first || (first >= 1 && last <= index->size() &&
+                          first == floor(first) && last == floor(last)),
+         "Index out of range.");
+  size_t size = (last < first) ? 0 : static_cast<size_t>(last - first) + 1;
   Cursor cursor;
   cursor.open(transaction.get(), database->getDBI());
-  vector<string> value_values;
-  while (cursor.get(MDB_NEXT)) {
-    Record* value = cursor.getValue();
-    value_values.push_back(string(value->begin(), value->end()));
+  size_t position = index->size();
+  vector<Record> keys(size);
+  vector<mxArray*> values(size);
+  for (size_t i = 0; i < size; ++i) {
+    Record value;
+    int status = index->seek(cursor.get(),
+                             static_cast<size_t>(first) - 1 + i,
+                             &position,
+                             keys[i].get(),
+                             value.get());
+    ASSERT(status == MDB_SUCCESS, mdb_strerror(status));
+    values[i] = format.decode(value);
   }
+  output.set(0, createCell(values));
+  output.set(1, key_format.decode(keys));
+  cursor.close();
+  transaction.commit();
+}
+
+MEX_DEFINE(rank) (int nlhs, mxArray* plhs[],
+                  int nrhs, const mxArray* prhs[]) {
+  InputArguments input(nrhs, prhs, 2);
+  OutputArguments output(nlhs, plhs, 2);
+  Database* database = Session<Database>::get(input.get(0));
+  Transaction transaction;
+  shared_ptr<OrdinalIndex> index = getOrdinalIndex(database, &transaction);
+  Cursor cursor;
+  cursor.open(transaction.get(), database->getDBI());
+  Record key;
+  getSingleKey(input.get(1), database->getFlags(), &key);
+  bool found = false;
+  size_t rank = index->rank(cursor.get(), *key.get(), &found);
   cursor.close();
   transaction.commit();
-  output.set(0, value_values);
+  output.set(0, static_cast<double>(rank + 1));
+  output.set(1, found);
+}
+
+MEX_DEFINE(tuple) (int nlhs, mxArray* plhs[],
+                   int nrhs, const mxArray* prhs[]) {
+  InputArguments input(nrhs, prhs, 1);
+  OutputArguments output(nlhs, plhs, 1);
+  string key;
+  TupleCodec::encode(input.get(0), &key);
+  output.set(0, key);
 }
 
 MEX_DEFINE(stat) (int nlhs, mxArray* plhs[],
@@ -657,8 +4700,12 @@ MEX_DEFINE(stat) (int nlhs, mxArray* plhs[],
   InputArguments input(nrhs, prhs, 1);
   OutputArguments output(nlhs, plhs, 1);
   Database* database = Session<Database>::get(input.get(0));
+  Transaction transaction;
+  transaction.renew(database);
   MDB_stat stat;
-  mdb_env_stat(database->getEnv(), &stat);
+  int status = mdb_stat(transaction.get(), database->getDBI(), &stat);
+  ASSERT(status == MDB_SUCCESS, mdb_strerror(status));
+  transaction.commit();
   output.set(0, stat);
 }
 
@@ -8,14 +8,23 @@ function testLMDB
     test_operations;
     test_cursor;
     test_transaction;
+    test_batch;
+    test_async;
+    test_growth;
     test_datatype;
+    test_datum;
     test_dump;
+    test_env;
+    test_integerkey;
   catch exception
     disp(exception.getReport());
   end
   if exist('_testdb', 'dir')
     rmdir('_testdb', 's');
   end
+  if exist('_testenv', 'dir')
+    rmdir('_testenv', 's');
+  end
   fprintf('DONE\n');
 
 end
@@ -35,6 +44,22 @@ function test_operations
   foo_counter = @(key, value, accum) accum + strcmp(value, 'foo');
   foo_count = database.reduce(foo_counter, 0);
   assert(foo_count == 1, 'Expected %d, but observed %d\n', 1, foo_count);
+  chunk_counter = @(keys, values, accum) accum + sum(strcmp(values, 'foo'));
+  foo_count = database.reduce(chunk_counter, 0, 'CHUNKSIZE', 1);
+  assert(foo_count == 1, 'Expected %d, but observed %d\n', 1, foo_count);
+  % Numeric keys are converted to char.
+  database.put([72, 105], 'hi');
+  assert(strcmp(database.get('Hi'), 'hi'));
+  key = 5;
+  database.put(key, 'five');
+  assert(isequal(database.mget({key}), {database.get(key)}));
+  database.remove(key);
+  database.remove([72, 105]);
+  assert(isempty(database.get('Hi')));
+  % Reads after a write see the new snapshot.
+  database.put('another-key', 'qux');
+  value = database.get('another-key');
+  assert(strcmp(value, 'qux'), 'ASSERTION FAILED: value = %s', value);
 end
 
 function test_readonly
@@ -77,6 +102,107 @@ function test_transaction
   clear database; % Make sure database is not destroyed before transaction.
 end
 
+function test_batch
+  disp('Testing batch operations');
+  database = lmdb.DB('_testdb');
+  database.mput(1:10, arrayfun(@(x) num2str(x * 2), 1:10, ...
+                               'UniformOutput', false));
+  [values, found] = database.mget({'1', 'no-such-key', '10'});
+  assert(isequal(found, [true, false, true]));
+  assert(strcmp(values{1}, '2') && isempty(values{2}) && strcmp(values{3}, '20'));
+  values = database.mget(1:10);
+  assert(all(strcmp(values, arrayfun(@(x) num2str(x * 2), 1:10, ...
+                                     'UniformOutput', false))));
+  numbers = [0.123456, -0, NaN, -Inf, 123456.789];
+  database.mput(numbers, repmat({'x'}, size(numbers)));
+  [~, found] = database.mget(arrayfun(@num2str, numbers, ...
+                                      'UniformOutput', false));
+  assert(all(found));
+  database.mremove(numbers);
+  % A numeric element of a cell array is a whole key.
+  database.mput({[72, 105]}, {'hi'});
+  assert(strcmp(database.get('Hi'), 'hi'));
+  assert(isequal(database.exists({[72, 105], 72}), [true, false]));
+  database.mremove({[72, 105]});
+  database.mremove({'1', '2'});
+  [~, found] = database.mget({'1', '2', '3'});
+  assert(isequal(found, [false, false, true]));
+  database.load({'z', 'b', 'a', 'b'}, {'1', '2', '3', '4'}, 'CHUNKSIZE', 2);
+  [values, found] = database.mget({'a', 'b', 'z'});
+  assert(all(found) && isequal(values, {'3', '4', '1'}));
+  keys = database.keys();
+  [values, sampled] = database.sample(numel(keys) + 1, 'SEED', 1);
+  assert(isequal(sort(sampled), keys));
+  assert(isequal(values, database.mget(sampled)));
+  [~, sampled2] = database.sample(3, 'SEED', 1);
+  assert(isequal(sampled2, sampled(1:3)));
+  [value, key] = database.getAt(2);
+  assert(strcmp(key, keys{2}) && strcmp(value, database.get(keys{2})));
+  [values, keys2] = database.rangeAt(2, numel(keys));
+  assert(isequal(keys2, keys(2:end)) && numel(values) == numel(keys) - 1);
+  [index, found] = database.rank(keys{3});
+  assert(index == 3 && found);
+  [index, found] = database.rank([keys{3}, char(0)]);
+  assert(index == 4 && ~found);
+  clear database;
+  database = lmdb.DB('_testdb', 'ORDINAL', true);
+  database.put([keys{1}, char(0)], 'x');
+  [index, found] = database.rank([keys{1}, char(0)]);
+  assert(index == 2 && found);
+  database.mremove(keys(1));
+  [value, key] = database.getAt(1);
+  assert(strcmp(key, [keys{1}, char(0)]) && strcmp(value, 'x'));
+  [~, sampled] = database.sample(numel(keys) + 1, 'SEED', 1);
+  assert(isequal(sort(sampled), database.keys()));
+  loader = database.loader('BATCHSIZE', 2, 'REVERSE', true, 'LIMIT', 3);
+  [~, loaded] = loader.next();
+  [~, rest, done] = loader.next();
+  assert(isequal([loaded, rest], database.keys('REVERSE', true, 'LIMIT', 3)));
+  assert(done);
+  clear loader database;
+end
+
+function test_async
+  disp('Testing async');
+  database = lmdb.DB('_testdb', 'ASYNC', true, 'COMMITSIZE', 10);
+  keys = arrayfun(@(i) sprintf('async-%03d', i), 1:100, 'UniformOutput', false);
+  for i = 1:numel(keys)
+    database.put(keys{i}, keys{i});
+  end
+  database.flush();
+  [values, found] = database.mget(keys);
+  assert(all(found) && isequal(values, keys));
+  database.remove('missing-key');
+  database.put('async-new', 'value');
+  error_raised = false;
+  try
+    database.flush();
+  catch
+    error_raised = true;
+  end
+  assert(error_raised);
+  database.mremove([keys, {'async-new'}]);
+  database.flush();
+  assert(isempty(database.get('async-new')));
+  % Clearing the database warns of the writes that fail to commit.
+  lastwarn('');
+  database.remove('missing-key');
+  clear database;
+  [~, identifier] = lastwarn();
+  assert(strcmp(identifier, 'lmdb:warning'));
+end
+
+function test_growth
+  disp('Testing growth');
+  database = lmdb.DB('_testdb', 'MAPSIZE', 65536, 'GROWTHPOLICY', 2);
+  keys = arrayfun(@(i) sprintf('growth-%03d', i), 1:100, 'UniformOutput', false);
+  values = repmat({zeros(1, 1000)}, size(keys));
+  database.mput(keys, values);
+  [~, found] = database.mget(keys);
+  assert(all(found));
+  database.mremove(keys);
+end
+
 function test_cursor
   disp('Testing cursor');
   database = lmdb.DB('_testdb');
@@ -100,6 +226,12 @@ function test_cursor
   assert(cursor.find('some-key'));
   disp([cursor.key, ': ', cursor.value]);
   clear cursor;
+  cursor = database.cursor('RDONLY', true);
+  [keys, values, count] = cursor.fetch(2);
+  assert(count == 2 && numel(keys) == 2 && numel(values) == 2);
+  [keys, ~, count] = cursor.fetch(numel(database.keys()));
+  assert(count == numel(database.keys()) - 2 && numel(keys) == count);
+  clear cursor;
   [key, value] = database.first();
   disp([key, ': ', value]);
   clear database;
@@ -112,13 +244,176 @@ function test_datatype
   database.put('1', value);
   value2 = cast(database.get('1'), 'uint8');
   assert(all(value == value2));
+  value3 = database.get('1', 'TYPE', 'uint8', 'SIZE', [16, 16]);
+  assert(isequal(value3, reshape(value, 16, 16)));
+  values = database.mget({'1'}, 'TYPE', 'int8');
+  assert(isa(values{1}, 'int8') && numel(values{1}) == 256);
+  value = single(rand(4, 3));
+  database.put('2', value);
+  assert(isequal(database.get('2', 'TYPE', 'single', 'SIZE', [4, 3]), value));
+  database.put('3', value, 'RESERVE', true);
+  assert(isequal(database.get('3', 'TYPE', 'single', 'SIZE', [4, 3]), value));
+  value = struct('a', {int16(magic(3)), 'text'}, 'b', {{1, true}, 1i});
+  database.put('4', value, 'SERIALIZE', true);
+  assert(isequal(database.get('4', 'SERIALIZE', true), value));
+  assert(isempty(database.get('missing', 'SERIALIZE', true)));
   clear database;
 end
 
+function test_datum
+  disp('Testing datum');
+  database = lmdb.DB('_testdb');
+  % Datum of channels = 2, height = 1, width = 2, data = 1:4, and label = 3.
+  database.put('datum1', uint8([8, 2, 16, 1, 24, 2, 34, 4, 1:4, 40, 3]));
+  database.put('datum2', uint8([8, 2, 16, 1, 24, 2, 34, 4, 5:8, 40, 4]));
+  [images, labels] = database.mgetDatum({'datum1', 'datum2'});
+  assert(isequal(images, reshape(uint8(1:8), [1, 2, 2, 2])));
+  assert(isequal(labels, [3; 4]));
+  cursor = database.cursor('RDONLY', true);
+  cursor.find('datum1');
+  [images, labels, keys] = cursor.fetchDatum(10);
+  assert(size(images, 4) == 1 && labels == 4 && isequal(keys, {'datum2'}));
+  clear cursor;
+  loader = database.loader('PREFIX', 'datum', 'BATCHSIZE', 1, 'DATUM', true);
+  [images, labels, keys, done] = loader.next();
+  assert(isequal(keys, {'datum1'}) && labels == 3 && size(images, 3) == 2);
+  assert(~done);
+  [~, ~, keys, done] = loader.next();
+  assert(isequal(keys, {'datum2'}) && done);
+  [~, ~, keys] = loader.next();
+  assert(isequal(keys, {'datum1'}));
+  loader = database.loader('PREFIX', 'datum', 'SHUFFLE', true, 'TYPE', 'uint8');
+  [values, keys, done] = loader.next();
+  assert(numel(values) == 2 && isequal(sort(keys), {'datum1', 'datum2'}));
+  assert(done);
+  % The loader keeps the snapshot when it was created.
+  loader = database.loader('PREFIX', 'datum', 'PREFETCH', 1);
+  database.remove('datum2');
+  loader.next();
+  [~, keys] = loader.next();
+  assert(isequal(keys, {'datum1', 'datum2'}));
+  clear loader database;
+end
+
+function test_env
+  disp('Testing env');
+  environment = lmdb.Env('_testenv');
+  images = environment.table('images');
+  labels = environment.table('labels');
+  images.put('key1', 'image1');
+  labels.put('key1', 'label1');
+  assert(isequal(environment.tables(), {'images', 'labels'}));
+  transaction = environment.begin();
+  transaction.put(images, 'key2', 'image2');
+  transaction.put(labels, 'key2', 'label2');
+  assert(strcmp(transaction.get(labels, 'key2'), 'label2'));
+  transaction.abort();
+  assert(isempty(labels.get('key2')));
+  transaction = images.begin();
+  transaction.put('key2', 'image2');
+  transaction.put(labels, 'key2', 'label2');
+  transaction.commit();
+  assert(strcmp(labels.get('key2'), 'label2'));
+  clear transaction;
+  postings = environment.table('postings', 'DUPSORT', true, ...
+                               'DUPFIXED', true, 'INTEGERDUP', true);
+  cursor = postings.cursor();
+  assert(cursor.putMultiple('term', uint32([92, 3, 15])) == 3);
+  clear cursor;
+  cursor = postings.cursor('RDONLY', true);
+  assert(cursor.find('term'));
+  assert(isequal(cursor.getMultiple('TYPE', 'uint32'), uint32([3, 15, 92])));
+  cached = environment.table('images', 'CACHESIZE', 1);
+  assert(strcmp(cached.get('key1'), 'image1'));
+  assert(strcmp(cached.get('key1'), 'image1'));
+  images.put('key2', 'image3');
+  assert(strcmp(cached.get('key2'), 'image3'));
+  [values, found] = cached.mget({'key1', 'key3', 'key2'});
+  assert(strcmp(values{1}, 'image1') && strcmp(values{3}, 'image3'));
+  assert(isequal(found, [true, false, true]));
+  filtered = environment.table('images', 'BLOOMBITS', 10);
+  assert(isequal(filtered.exists({'key1', 'key3'}), [true, false]));
+  assert(isempty(filtered.get('key3')));
+  filtered.put('key3', 'image4');
+  assert(filtered.exists('key3'));
+  images.put('key4', 'image5');
+  assert(strcmp(filtered.get('key4'), 'image5'));
+  transaction = environment.begin();
+  transaction.put(images, 'key5', 'image6');
+  transaction.put(labels, 'key5', 'label5');
+  transaction.commit();
+  clear transaction;
+  assert(strcmp(filtered.get('key5'), 'image6'));
+  filtered.remove('key5');
+  filtered.remove('key3');
+  filtered.remove('key4');
+  assert(isequal(filtered.exists({'key3', 'key4'}), [false, false]));
+  clear cursor postings environment;
+  assert(strcmp(images.get('key1'), 'image1'));
+  assert(strcmp(labels.get('key1'), 'label1'));
+  assert(images.stat().entries == 2);
+  clear cached filtered images labels;
+end
+
+function test_integerkey
+  disp('Testing integer key');
+  environment = lmdb.Env('_testenv');
+  ids = environment.table('ids');
+  ids.mput(int64([5, -3, 1000, -70000]), {'a', 'b', 'c', 'd'});
+  assert(isequal(ids.keys('KEYTYPE', 'int64'), int64([-70000, -3, 5, 1000])));
+  assert(strcmp(ids.get(int64(-3)), 'b'));
+  keys = ids.keys('KEYTYPE', 'int64', 'START', int64(0), 'THREADS', 2);
+  assert(isequal(keys, int64([5, 1000])));
+  native = environment.table('native', 'INTEGERKEY', true);
+  native.mput(uint32([300, 2, 70000]), {'a', 'b', 'c'});
+  [keys, values] = native.scan('KEYTYPE', 'uint32', 'REVERSE', true);
+  assert(isequal(keys, uint32([70000, 300, 2])));
+  assert(isequal(values, {'c', 'a', 'b'}));
+  cursor = native.cursor('RDONLY', true);
+  assert(cursor.find(uint32(300)));
+  assert(cursor.getKey('KEYTYPE', 'uint32') == 300);
+  clear cursor native;
+  events = environment.table('events');
+  events.put(lmdb.tuple(uint64(2), -1.5, 'b'), 'x');
+  events.put(lmdb.tuple(uint64(2), 3, 'a'), 'y');
+  events.put(lmdb.tuple(uint64(10), -7, 'c'), 'z');
+  keys = events.keys('KEYTYPE', 'tuple');
+  assert(isequal(keys{1}, {uint64(2), -1.5, 'b'}));
+  assert(isequal(keys{3}, {uint64(10), -7, 'c'}));
+  values = events.values('PREFIX', lmdb.tuple(uint64(2)));
+  assert(isequal(values, {'x', 'y'}));
+  % Chars beyond 8 bits are kept apart and in order.
+  events.put(lmdb.tuple(uint64(20), 0, char(321)), 'p');
+  events.put(lmdb.tuple(uint64(20), 0, char(65)), 'q');
+  events.put(lmdb.tuple(uint64(20), 0, char(256)), 'r');
+  keys = events.keys('KEYTYPE', 'tuple', 'PREFIX', lmdb.tuple(uint64(20)));
+  assert(isequal(cellfun(@(key) double(key{3}), keys), [65, 256, 321]));
+  clear events ids environment;
+end
+
 function test_dump
   disp('Testing dump');
   database = lmdb.DB('_testdb', 'RDONLY', true);
+  keys = database.keys();
+  assert(isequal(database.keys('CACHE', true), keys));
+  assert(isequal(database.keys('CACHE', true), keys));
+  assert(isequal(cellstr(database.keys('PACKED', true)), keys(:)));
+  cache_file = fullfile(tempdir, 'lmdb_keys.cache');
+  assert(isequal(database.keys('CACHEFILE', cache_file), keys));
+  assert(isequal(database.keys('CACHEFILE', cache_file), keys));
+  delete(cache_file);
   keys = database.keys;
   values = database.values;
+  assert(numel(keys) == numel(values));
+  sorted_keys = sort(keys);
+  range_keys = database.keys('START', sorted_keys{2}, 'END', sorted_keys{end});
+  assert(isequal(range_keys, sorted_keys(2:end-1)));
+  reverse_keys = database.keys('REVERSE', true, 'LIMIT', 2);
+  assert(isequal(reverse_keys, sorted_keys(end:-1:end-1)));
+  [prefix_keys, prefix_values] = database.scan('PREFIX', 'some');
+  assert(isequal(prefix_keys, {'some-key'}) && numel(prefix_values) == 1);
+  [parallel_keys, parallel_values] = database.scan('THREADS', 4);
+  assert(isequal(parallel_keys, keys) && isequal(parallel_values, values));
+  assert(isequal(database.keys('THREADS', 4, 'REVERSE', true), keys(end:-1:1)));
   clear database;
 end